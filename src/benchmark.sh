@@ -0,0 +1,62 @@
+#!/bin/bash
+
+# Builds brainfuck.cpp a few ways and times each build on our programs.
+# Run it from src/. RUNS=n and LONG_RUNS=n change how many tries each number is the median of.
+
+RUNS=${RUNS:-101}
+LONG_RUNS=${LONG_RUNS:-5}
+build=$(mktemp -d)
+trap 'rm -rf "$build"' EXIT
+
+g++ -O2 -pthread -o "$build/brainfuck" brainfuck.cpp || exit 1
+g++ -O2 -static -pthread -DBRAINFUCK_FAST_START -o "$build/brainfuck-fast" brainfuck.cpp || exit 1
+./pgo.sh "$build/brainfuck-pgo" || exit 1
+
+median() {
+    sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+# Microseconds from starting a command to the first byte of its output (needs bash 5, for EPOCHREALTIME).
+# That includes forking, and the read on the other end of the pipe, so compare against the /bin/echo line.
+first_output() {
+    for i in $(seq $RUNS); do
+        start=${EPOCHREALTIME/./}
+        end=$("$@" 2> /dev/null | { IFS= read -r -n 1 _; echo ${EPOCHREALTIME/./}; })
+        echo $(( end - start ))
+    done | median
+}
+
+# Milliseconds a whole run takes, reading $input if that's set.
+run_time() {
+    for i in $(seq $LONG_RUNS); do
+        start=${EPOCHREALTIME/./}
+        "$@" < "${input:-/dev/null}" > /dev/null 2>&1
+        echo $(( (${EPOCHREALTIME/./} - start) / 1000 ))
+    done | median
+}
+
+# Run time with and without profile-guided optimization, and how much faster that is.
+compare() {
+    local name=$1
+    shift
+    plain=$(run_time "$build/brainfuck" "$@")
+    pgo=$(run_time "$build/brainfuck-pgo" "$@")
+    printf "  %-36s %8s %8s %7s%%\n" "$name" $plain $pgo $(( plain ? (plain - pgo) * 100 / plain : 0 ))
+}
+
+echo "exec to first output, median of $RUNS (us):"
+printf "  %-36s %8s\n" "/bin/echo (baseline)" "$(first_output /bin/echo x)"
+for program in helloworld.bf quine.bf; do
+    printf "  %-36s %8s\n" "brainfuck $program" "$(first_output "$build/brainfuck" $program)"
+    printf "  %-36s %8s\n" "brainfuck-fast $program" "$(first_output "$build/brainfuck-fast" $program)"
+    printf "  %-36s %8s\n" "brainfuck-fast --direct $program" "$(first_output "$build/brainfuck-fast" --direct $program)"
+done
+
+echo
+echo "run time, median of $LONG_RUNS (ms):"
+printf "  %-36s %8s %8s %8s\n" "" "-O2" "PGO+LTO" "gain"
+compare "heavy.bf" heavy.bf
+compare "99botles.bf" 99botles.bf
+input=../american-english.txt compare "echo.bf < american-english.txt" --fuel 2000000 echo.bf
+compare "--tree heavy.bf" --tree heavy.bf
+compare "--direct heavy.bf" --direct heavy.bf
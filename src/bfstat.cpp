@@ -0,0 +1,92 @@
+/*
+= bfstat
+
+Watches a brainfuck.exe that was started with --publish-stats, without stopping it or slowing it down:
+
+----
+g++ -O2 -o bfstat bfstat.cpp
+brainfuck.exe --publish-stats long-job.bf &
+bfstat $!
+----
+
+Prints a line a second (or every however many seconds you give after the pid) until the job is done.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <string>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "brainfuck.h"
+
+using namespace std;
+
+const char * const phases[] = { "starting", "parsing", "lowering", "running", "done" };
+
+/**
+ * A consistent copy of what the writer has published: see bf::Stats.
+ */
+bf::Stats snapshot(const bf::Stats * shared) {
+    bf::Stats copy;
+    while (true) {
+        unsigned long long before = shared->sequence;
+        atomic_thread_fence(memory_order_acquire);
+        copy.magic = shared->magic;
+        copy.phase = shared->phase;
+        copy.files = shared->files;
+        copy.iterations = shared->iterations;
+        copy.input = shared->input;
+        copy.output = shared->output;
+        copy.compiled = shared->compiled;
+        atomic_thread_fence(memory_order_acquire);
+        if (before % 2 == 0 && shared->sequence == before) break;
+        sched_yield(); // caught it mid-update
+    }
+    return copy;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <pid> [seconds]\n", argv[0]);
+        return 2;
+    }
+    pid_t pid = atoi(argv[1]);
+    double every = argc > 2 ? atof(argv[2]) : 1;
+    string name = "/brainfuck." + to_string(pid);
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s: %s (was it started with --publish-stats?)\n", argv[0], name.c_str(), strerror(errno));
+        return 1;
+    }
+    void * mapped = mmap(NULL, sizeof(bf::Stats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], name.c_str(), strerror(errno));
+        return 1;
+    }
+    const bf::Stats * shared = (const bf::Stats *)mapped;
+    if (shared->magic != bf::Stats::MAGIC) {
+        fprintf(stderr, "%s: %s: not a brainfuck stats segment\n", argv[0], name.c_str());
+        return 1;
+    }
+    bf::Stats last = snapshot(shared);
+    while (true) {
+        usleep((useconds_t)(every * 1000000));
+        bf::Stats now = snapshot(shared);
+        unsigned phase = now.phase <= bf::Stats::DONE ? now.phase : (unsigned)bf::Stats::STARTING;
+        printf("%-8s  files %llu  iterations %llu (%.0f/s)  in %llu  out %llu  bytecode %llu\n",
+               phases[phase], now.files, now.iterations, (now.iterations - last.iterations) / every,
+               now.input, now.output, now.compiled);
+        fflush(stdout);
+        if (now.phase == bf::Stats::DONE || (kill(pid, 0) && errno == ESRCH)) break;
+        last = now;
+    }
+    munmap(mapped, sizeof(bf::Stats));
+    return 0;
+}
@@ -4,14 +4,62 @@
 If you have gcc:
 
 ----
-g++ -o brainfuck.exe brainfuck.cpp
+g++ -O2 -pthread -o brainfuck.exe brainfuck.cpp
 brainfuck.exe helloworld.bf
 ----
+
+For tiny programs, most of the time is starting the process. The fast-start build leaves out iostream
+(and everything that needs it: --tree, --profile-*, --opcode-stats, --samples-out, the printers) and links statically:
+
+----
+g++ -O2 -static -pthread -DBRAINFUCK_FAST_START -o brainfuck-fast.exe brainfuck.cpp
+----
+
+To embed it instead, see brainfuck.h. To watch a long run from outside, see bfstat.cpp.
 */
 
 #include <vector>
+#if !defined(BRAINFUCK_FAST_START) && !defined(BRAINFUCK_LIBRARY)
 #include <iostream>
 #include <fstream>
+#endif
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <climits>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <signal.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __linux__
+#include <sys/uio.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#endif
+#include "brainfuck.h"
 
 using namespace std;
 
@@ -25,7 +73,8 @@ typedef enum {
     SHIFT_RIGHT, // >
     INPUT, // ,
     OUTPUT, // .
-	ZERO // [-] or [+]
+	ZERO, // [-] or [+]
+	TRAP // a loop that never ends once it's entered (see neverEnds)
 } Command;
 
 // Forward references. Silly C++!
@@ -49,6 +98,7 @@ class Visitor {
  */
 class Node {
     public:
+        virtual ~Node() {}
         virtual void accept (Visitor *v) = 0;
 };
 
@@ -69,6 +119,7 @@ class CommandNode : public Node {
                 case ',': command = INPUT; break;
                 case '.': command = OUTPUT; break;
 				case 'z': command = ZERO; break;
+				case 't': command = TRAP; break;
             }
 			count = n;
         }
@@ -80,15 +131,32 @@ class CommandNode : public Node {
 class Container: public Node {
     public:
         vector<Node*> children;
+        ~Container() {
+            for (vector<Node*>::iterator it = children.begin(); it != children.end(); ++it) {
+                delete *it;
+            }
+        }
         virtual void accept (Visitor * v) = 0;
 };
 
+/**
+ * What a training run saw happen at one loop.
+ */
+struct LoopProfile {
+    long long iterations; // times the body actually ran
+};
+
 /**
  * Loop publicly extends Node to accept visitors.
  * Loop represents a loop in Brainfuck.
+ * Loops are numbered in source order so a profile from one run lines up with the tree of the next.
  */
 class Loop : public Container {
     public:
+        int id;
+        const LoopProfile * profile; // null unless --profile-in gave us one
+        const char * at; // its '[' in the source text (good for as long as the text is), or null
+        Loop() : id(0), profile(NULL), at(NULL) {}
         void accept (Visitor * v) {
             v->visit(this);
         }
@@ -109,36 +177,92 @@ class Program : public Container {
 };
 
 /**
- * Read in the file by recursive descent.
+ * Does this loop never end, once it's entered? entry is the loop cell's value on the way in, or -1 if we don't know it.
+ *
+ * We only look at straight bodies with no I/O that bring the pointer back, so the loop cell gets the same treatment
+ * every time round. Either a [-] in the body sets it, and it comes out as the same c every time (so never zero,
+ * unless c is); or it moves by d a time, and from x it only gets to zero if x + k*d = 0 (mod 256) for some k,
+ * which needs gcd(d, 256) to divide x. With d = 0 (as in [] or [>+<]) that's never, whatever x was.
+ */
+bool neverEnds(const Loop * loop, int entry) {
+	int at = 0;
+	int change = 0;
+	bool set = false;
+	for (vector<Node*>::const_iterator it = loop->children.begin(); it != loop->children.end(); ++it) {
+		const CommandNode * leaf = dynamic_cast<const CommandNode *>(*it);
+		if (!leaf) return false;
+		switch (leaf->command) {
+			case INCREMENT:   if (!at) change += leaf->count; break;
+			case DECREMENT:   if (!at) change -= leaf->count; break;
+			case SHIFT_LEFT:  at -= leaf->count; break;
+			case SHIFT_RIGHT: at += leaf->count; break;
+			case ZERO:        if (!at) { set = true; change = 0; } break;
+			case INPUT:
+			case OUTPUT:
+			case TRAP:        return false;
+		}
+	}
+	change &= 255;
+	if (at) return false;
+	if (set) return change != 0;
+	if (!change) return true;
+	if (entry < 0 || !(entry & 255)) return false;
+	return (entry & 255) % (change & -change) != 0; // gcd(d, 256) is d's lowest set bit
+}
+
+/**
+ * In the counted format (--rle, or a .bfr file), a command may be followed by how many times it repeats:
+ * +5>3[-1>+2<1] is +++++>>>[->++<]. Counts past INT_MAX stop there.
+ */
+static int repeats(const char *& cursor, const char * end) {
+	if (cursor == end || *cursor < '0' || *cursor > '9') return 1;
+	long long n = 0;
+	while (cursor < end && *cursor >= '0' && *cursor <= '9') {
+		n = min(n * 10 + (*cursor++ - '0'), (long long)INT_MAX);
+	}
+	return (int)n;
+}
+
+/**
+ * Read in the source by recursive descent, from cursor up to end. Leaves cursor just past the ']' that ended the container.
+ * With counted set, digits after a command are its repeat count instead of a comment.
  * Modify as necessary and add whatever functions you need to get things done.
  */
-void parse(fstream & file, Container * container) {
+void parse(const char *& cursor, const char * end, Container * container, bool counted = false) {
 	Loop * program; // Our loop object
 	char c;
-	int count;
+	long long count;
     // How to insert a node into the container
 
-	while (file >> c) {
-		count = 1; // reset count
+	while (cursor < end) {
+		c = *cursor++;
+		count = counted ? repeats(cursor, end) : 1; // reset count
 		//command case
 		if(c == '+' || c == '-' || c == '<' || c == '>' || c == ',' || c == '.'){
-			while(((char)file.peek()) == c){ // Squash down repeats, aka +++ -> Node with + and count = 3
-				file >> c; // move file pointer
-				count++; // increase
+			while(cursor < end && *cursor == c){ // Squash down repeats, aka +++ -> Node with + and count = 3
+				cursor++; // move file pointer
+				count += counted ? repeats(cursor, end) : 1; // increase
 			}
-			container->children.push_back(new CommandNode(c,count)); //add our node to the tree
+			if (count) container->children.push_back(new CommandNode(c, (int)min(count, (long long)INT_MAX))); //add our node to the tree
 		}
 		else if(c == '['){  // Loop case
 			program = new Loop(); // Create new loop object
-			parse(file, program); // Parse the inside of the loop
+			program->at = cursor - 1;
+			parse(cursor, end, program, counted); // Parse the inside of the loop
 			if (program->children.size() == 1) { // If we have only one object inside the loop, check for special cases.
-				CommandNode* child = dynamic_cast<CommandNode*>(program->children.front());  // 
-				if (child->command == INCREMENT || child->command == DECREMENT) { // If loop is either [+] or [-]
+				CommandNode* child = dynamic_cast<CommandNode*>(program->children.front());  // Might be a loop, e.g. [[>]]
+				if (child && (child->command == INCREMENT || child->command == DECREMENT) && child->count % 2) { // If loop is [+] or [-] (or [+++], any odd count gets to zero)
 					container->children.push_back(new CommandNode('z',1)); // Add special ZERO node.
 					delete program; // Avoid lingering loop objects
+				} else if (neverEnds(program, -1)) {
+					container->children.push_back(new CommandNode('t',1)); // e.g. [] or [+-], stuck once entered
+					delete program;
 				} else {
 					container->children.push_back(program);	// Normal non-special loop with size one.
 				}
+			} else if (neverEnds(program, -1)) {
+				container->children.push_back(new CommandNode('t',1));
+				delete program;
 			}else{
 				container->children.push_back(program);	 //Add a normal non-special loop to the tree.
 			}
@@ -151,6 +275,119 @@ void parse(fstream & file, Container * container) {
 }
 
 
+/**
+ * The profile a training run leaves behind (--profile-out) and later compiles read back (--profile-in).
+ * It's a plain text file, one line per loop, indexed by Loop::id, under the Fingerprint of the program it's for:
+ *
+ *     brainfuck-profile <fingerprint> <loops>
+ *     <id> <iterations>
+ */
+class Profile {
+    public:
+        unsigned long long program; // the Fingerprint of the program it was taken from
+        vector<LoopProfile> loops;
+        Profile() : program(0) {}
+        void reset(unsigned long long fingerprint, int count) {
+            LoopProfile empty = { 0 };
+            program = fingerprint;
+            loops.assign(count, empty);
+        }
+#if !defined(BRAINFUCK_FAST_START) && !defined(BRAINFUCK_LIBRARY)
+        bool save(const char * path) const {
+            ofstream out(path);
+            out << "brainfuck-profile " << program << ' ' << loops.size() << '\n';
+            for (size_t i = 0; i < loops.size(); i++) {
+                out << i << ' ' << loops[i].iterations << '\n';
+            }
+            return out.good();
+        }
+        bool load(const char * path) {
+            ifstream in(path);
+            string magic;
+            unsigned long long fingerprint;
+            size_t count, id;
+            if (!(in >> magic >> fingerprint >> count) || magic != "brainfuck-profile" || count > INT_MAX) {
+                return false;
+            }
+            // Nothing gets sized by the header's count until that many lines are really there.
+            vector<pair<size_t, LoopProfile> > read;
+            for (size_t i = 0; i < count; i++) {
+                LoopProfile p;
+                if (!(in >> id >> p.iterations) || id >= count) {
+                    return false;
+                }
+                read.push_back(make_pair(id, p));
+            }
+            reset(fingerprint, count);
+            for (size_t i = 0; i < read.size(); i++) loops[read[i].first] = read[i].second;
+            return true;
+        }
+#endif
+};
+
+/**
+ * Numbers every loop in source order, and hands each one its profile if there is one.
+ * Only give it a profile taken from this program (check its Fingerprint first): any other won't line up.
+ */
+class LoopNumberer : public Visitor {
+    int next;
+    const Profile * profile;
+    public:
+        int count;
+        LoopNumberer(const Profile * p = NULL) : next(0), profile(p), count(0) {}
+        void visit(const CommandNode *) {}
+        void visit(const Loop * loop) {
+            Loop * l = const_cast<Loop *>(loop);
+            l->id = next++;
+            l->profile = NULL;
+            if (profile && l->id < (int)profile->loops.size()) {
+                l->profile = &profile->loops[l->id];
+            }
+            for (vector<Node*>::const_iterator it = loop->children.begin(); it != loop->children.end(); ++it) {
+                (*it)->accept(this);
+            }
+        }
+        void visit(const Program * program) {
+            next = 0;
+            for (vector<Node*>::const_iterator it = program->children.begin(); it != program->children.end(); ++it) {
+                (*it)->accept(this);
+            }
+            count = next;
+        }
+};
+
+/**
+ * Hashes a parsed program (FNV-1a over its commands, their counts and its loops), so a profile can say which
+ * program it was taken from. Comments and spacing don't change it; anything that changes what runs does.
+ */
+class Fingerprint : public Visitor {
+    public:
+        unsigned long long hash;
+        Fingerprint() : hash(14695981039346656037ULL) {}
+        void visit(const CommandNode * leaf) {
+            mix(leaf->command);
+            mix(leaf->count);
+        }
+        void visit(const Loop * loop) {
+            mix(-1);
+            for (vector<Node*>::const_iterator it = loop->children.begin(); it != loop->children.end(); ++it) {
+                (*it)->accept(this);
+            }
+            mix(-2);
+        }
+        void visit(const Program * program) {
+            for (vector<Node*>::const_iterator it = program->children.begin(); it != program->children.end(); ++it) {
+                (*it)->accept(this);
+            }
+        }
+    private:
+        void mix(long long value) {
+            for (int i = 0; i < 8; i++) {
+                hash = (hash ^ (unsigned char)(value >> (8 * i))) * 1099511628211ULL;
+            }
+        }
+};
+
 /*
 Program -> Sequence
 
@@ -160,42 +397,172 @@ Sequence -> any other character, ignore (treat as a comment)
 Sequence -> "" (empty string)
 
 Command -> '+' | '-' | '<' | '>' | ',' | '.'
+Command -> ('+' | '-' | '<' | '>' | ',' | '.') Digits   (counted format only)
 
 Loop -> '[' Sequence ']'
 */
 
+#if !defined(BRAINFUCK_FAST_START) && !defined(BRAINFUCK_LIBRARY)
+
 /**
  * A printer for Brainfuck abstract syntax trees.
  * As a visitor, it will just print out the commands as is.
  * For Loops and the root Program node, it walks trough all the children.
+ * A counted printer writes each command once with its count after it (the format parse() reads with counted set).
+ * ZERO comes out as [-] either way, and TRAP as [] (which does the same), so the output reads back.
+ *
+ * A minifying printer writes the shortest program it can see that does the same thing: adjacent +/- and </>
+ * cancel (adds are mod 256, so 200 +'s print as 56 -'s), an add right before a ZERO is dropped, and so is a loop
+ * that can't be entered: one at the start (or after only moves), right after another loop, or right after a ZERO.
+ * Comments went with parsing. What's left is the canonical form we store and cache programs under.
+ *
+ * Output collects in a buffer, a run of a command at a time, and goes out when it fills and at the end.
  */
 class Printer : public Visitor {
     public:
+        bool counted;
+        bool minified;
+        Printer(bool c = false, bool m = false, ostream & o = cout) : counted(c), minified(m), out(o), used(0) {}
+        ~Printer() {
+            flush();
+        }
         void visit(const CommandNode * leaf) {
-		for (int i = 0; i < leaf->count; i++){
-				switch (leaf->command) {
-					case INCREMENT:   cout << '+'; break;
-					case DECREMENT:   cout << '-'; break;
-					case SHIFT_LEFT:  cout << '<'; break;
-					case SHIFT_RIGHT: cout << '>'; break;
-					case INPUT:       cout << ','; break;
-					case OUTPUT:      cout << '.'; break;
-					case ZERO:		  cout << 'z'; break;
-				}
-			}
+            if (!minified) {
+                if (leaf->command == ZERO) {
+                    zero();
+                } else if (leaf->command == TRAP) {
+                    trap();
+                } else {
+                    run("+-<>,."[leaf->command], leaf->count);
+                }
+                return;
+            }
+            switch (leaf->command) {
+                case INCREMENT:   add(leaf->count); break;
+                case DECREMENT:   add(-leaf->count); break;
+                case SHIFT_RIGHT: move(leaf->count); break;
+                case SHIFT_LEFT:  move(-leaf->count); break;
+                case INPUT:
+                    settle(); // not dead: at EOF, ',' leaves the cell alone
+                    run(',', leaf->count);
+                    known = pristine = false;
+                    break;
+                case OUTPUT:
+                    settle();
+                    run('.', leaf->count);
+                    break;
+                case ZERO:
+                    delta = 0; // overwritten
+                    if (zeroHere()) break; // a pending move stays pending: nothing was written
+                    settle();
+                    zero();
+                    known = true;
+                    break;
+                case TRAP:
+                    if (zeroHere()) break;
+                    settle();
+                    trap();
+                    known = true; // if we got past it
+                    break;
+            }
         }
         void visit(const Loop * loop) {
-            cout << '[';
+            if (minified) {
+                if (zeroHere()) return; // never entered
+                settle();
+                known = false;
+            }
+            put('[');
             for (vector<Node*>::const_iterator it = loop->children.begin(); it != loop->children.end(); ++it) {
                 (*it)->accept(this);
             }
-            cout << ']';
+            if (minified) {
+                settle();
+                known = true;
+                pristine = false;
+            }
+            put(']');
         }
         void visit(const Program * program) {
+            delta = 0;
+            shift = 0;
+            known = pristine = true;
             for (vector<Node*>::const_iterator it = program->children.begin(); it != program->children.end(); ++it) {
                 (*it)->accept(this);
             }
-            cout << '\n';
+            if (minified) settle();
+            put('\n');
+            flush();
+        }
+        void flush() {
+            out.write(buffer, used);
+            out.flush();
+            used = 0;
+        }
+    private:
+        static const size_t SIZE = 1 << 16;
+        ostream & out;
+        char buffer[SIZE];
+        size_t used;
+        // Minifying: what's been folded but not written yet (only ever one of them), and what we know of the tape.
+        int delta;
+        long long shift;
+        bool known;    // the current cell is zero
+        bool pristine; // every cell is zero
+        void put(char c) {
+            if (used == SIZE) flush();
+            buffer[used++] = c;
+        }
+        void run(char c, long long count) {
+            if (counted) {
+                put(c);
+                if (count != 1) {
+                    if (SIZE - used < 24) flush();
+                    used += snprintf(buffer + used, 24, "%lld", count);
+                }
+                return;
+            }
+            while (count > 0) {
+                if (used == SIZE) flush();
+                size_t n = (size_t)min((long long)(SIZE - used), count);
+                memset(buffer + used, c, n);
+                used += n;
+                count -= n;
+            }
+        }
+        void zero() {
+            put('[');
+            put('-');
+            put(']');
+        }
+        void trap() {
+            put('[');
+            put(']');
+        }
+        void add(int n) {
+            if (shift) settle();
+            delta = (delta + n % 256 + 256) % 256;
+        }
+        void move(long long n) {
+            if (delta) settle();
+            shift += n;
+        }
+        // Whether the cell we'd be at, once what's folded up is written, is known to be zero.
+        bool zeroHere() const {
+            return !delta && (shift ? pristine : known);
+        }
+        // Writes out whatever is folded up.
+        void settle() {
+            if (delta) {
+                if (delta <= 128) run('+', delta); else run('-', 256 - delta);
+                delta = 0;
+                known = pristine = false;
+            }
+            if (shift) {
+                if (shift > 0) run('>', shift); else run('<', -shift);
+                shift = 0;
+                known = pristine;
+            }
         }
 };
 
@@ -211,6 +578,7 @@ class JavaCompiler : public Visitor {
 						case INPUT:       cout << "array[pointer] = (byte)System.in.read();\n"; break;
 						case OUTPUT:      cout << "System.out.print((char)array[pointer]);\n"; break;
 						case ZERO:		  cout << "array[pointer]=0;\n"; break;
+						case TRAP:        cout << "if (array[pointer] != 0) throw new IllegalStateException(\"entered a loop that never ends\");\n"; break;
 					}
 			}
         }
@@ -241,6 +609,8 @@ class Interpreter : public Visitor {
     char memory[30000];
     int pointer;
     public:
+        Profile * profile; // when set, this is a training run: record what every loop does
+        Interpreter() : pointer(0), profile(NULL) {}
         void visit(const CommandNode * leaf) {
 			for (int i = 0; i < leaf->count; i++){
 				switch (leaf->command) {
@@ -265,11 +635,19 @@ class Interpreter : public Visitor {
 					case ZERO:
 						memory[pointer]=0;
 						break;
+					case TRAP:
+						if (memory[pointer]) {
+							cout.flush();
+							cerr << "entered a loop that never ends" << endl;
+							exit(1);
+						}
+						break;
 				}
 			}
         }
         void visit(const Loop * loop) {
 			while(memory[pointer]){
+				if (profile) profile->loops[loop->id].iterations++;
 				for (vector<Node*>::const_iterator it = loop->children.begin(); it != loop->children.end(); ++it) {
 					(*it)->accept(this);
 				}
@@ -278,7 +656,7 @@ class Interpreter : public Visitor {
         void visit(const Program * program) {
             // zero init the memory array
             // set pointer to zero
-			for(int i =0; i <= 30000; i++){
+			for(int i =0; i < 30000; i++){
 				memory[i] = 0;
 			}
 			pointer = 0;
@@ -289,22 +667,2972 @@ class Interpreter : public Visitor {
         }
 };
 
-int main(int argc, char *argv[]) {
-    fstream file;
-    Program program;
-    Printer printer;
-	JavaCompiler compiler;
-    Interpreter interpreter;
-    if (argc == 1) {
-        cout << argv[0] << ": No input files." << endl;
-    } else if (argc > 1) {
-        for (int i = 1; i < argc; i++) {
-            file.open(argv[i], fstream::in);
-            parse(file, & program);
-         //  program.accept(&printer);
-           program.accept(&interpreter);
-		 //	program.accept(&compiler);
-            file.close();
+#endif
+
+/**
+ * Superinstructions: opcode pairs and triples that get one handler, and so one dispatch, between them.
+ * Only the last piece of one may jump.
+ * This list is picked from what --opcode-stats reports over our programs; each entry becomes an OP_A_B(_C) opcode,
+ * a case in the dispatch loop, and a handler instantiated from the fused<> templates below.
+ */
+#define SUPERINSTRUCTIONS(PAIR, TRIPLE) \
+    PAIR(ADD, ADD) \
+    PAIR(ADD, JNZ) \
+    PAIR(ZERO, ADD) \
+    PAIR(ADD, ZERO) \
+    PAIR(ADD, MOVE) \
+    PAIR(MOVE, JNZ) \
+    TRIPLE(ADD, ADD, JNZ) \
+    TRIPLE(ADD, ADD, ADD) \
+    TRIPLE(ZERO, ADD, JNZ) \
+    TRIPLE(ADD, ZERO, ADD)
+
+/**
+ * Opcodes for the flat bytecode the tree gets lowered to.
+ * Pointer moves inside a straight run of commands are folded into offsets, so most instructions carry one.
+ */
+typedef enum {
+    OP_ADD,  // memory[pointer + offset] += arg
+    OP_MOVE, // pointer += arg
+    OP_ZERO, // memory[pointer + offset] = 0
+    OP_MUL,  // memory[pointer + offset] += arg * memory[pointer] (a folded multiply loop, one target)
+    OP_ADDV, // memory[pointer + offset + i] += lanes[arg][i], for 16 cells at once
+    OP_MULV, // memory[pointer + offset + i] += lanes[arg][i] * memory[pointer], for 16 cells at once
+    OP_IN,   // read arg bytes into memory[pointer + offset]
+    OP_OUT,  // write memory[pointer + offset] arg times
+    OP_JZ,   // loop head: if memory[pointer] == 0, jump to arg
+    OP_JNZ,  // loop back-edge (or entry to a cold loop): if memory[pointer] != 0, jump to arg
+    OP_JMP,  // jump to arg, back out of cold code
+    OP_NOP,  // padding so a hot loop body starts on a cache line
+    OP_TRANSDUCE, // if memory[pointer] != 0, run transducer arg over all the input there is (see Transducer)
+    OP_MEMO,       // loop head: if memo arg has seen this window before, fill in the result and jump past the loop
+    OP_MEMO_STORE, // loop exit: remember what the window came out as
+    OP_TRAP, // if memory[pointer + offset] != 0, stop: it's a loop that never ends
+    OP_END,
+#define PAIR(a, b) OP_##a##_##b,
+#define TRIPLE(a, b, c) OP_##a##_##b##_##c,
+    SUPERINSTRUCTIONS(PAIR, TRIPLE)
+#undef PAIR
+#undef TRIPLE
+    OP_COUNT
+} Opcode;
+
+const char * const opcodeNames[OP_COUNT] = {
+    "ADD", "MOVE", "ZERO", "MUL", "ADDV", "MULV", "IN", "OUT", "JZ", "JNZ", "JMP", "NOP", "TRANSDUCE", "MEMO", "MEMO_STORE", "TRAP", "END",
+#define PAIR(a, b) #a "_" #b,
+#define TRIPLE(a, b, c) #a "_" #b "_" #c,
+    SUPERINSTRUCTIONS(PAIR, TRIPLE)
+#undef PAIR
+#undef TRIPLE
+};
+
+/**
+ * One bytecode instruction. Four ints, so four of them fill a 64 byte cache line.
+ */
+struct Instruction {
+    Opcode op;
+    int arg;
+    int offset;
+    int loop; // Loop::id of the innermost enclosing loop, -1 at the top level
+};
+
+const int CACHE_LINE = 64;
+const int PER_LINE = CACHE_LINE / sizeof(Instruction);
+
+/**
+ * A stream filter loop, boiled down to tables: for each input byte, what one iteration prints,
+ * and what it leaves in the cells it uses (its window, as offsets from the loop cell).
+ *
+ * A loop qualifies if each iteration reads exactly one byte, and everything it prints, tests or adds to was set
+ * earlier in the same iteration (by that read, or a [-]). Then nothing carries over between iterations but the
+ * loop cell, which it must leave alone, so the whole loop is a function from input bytes to output bytes.
+ * Think echo.bf or rot13. We find out by running the body on all 256 bytes at compile time.
+ */
+struct Transducer {
+    vector<int> window;
+    string output[256];
+    string after[256];   // window values after one iteration, in window order
+    unsigned char table[256];
+    bool single;   // every byte prints exactly one byte (table has it)
+    bool identity; // ...and it's the same byte
+
+    bool extract(const Loop * loop) {
+        set<int> touched;
+        for (int b = 0; b < 256; b++) {
+            Simulation s(b);
+            if (!s.run(loop->children) || s.pointer != 0 || s.reads != 1) {
+                return false;
+            }
+            if (b == 0) {
+                for (map_t::const_iterator it = s.cells.begin(); it != s.cells.end(); ++it) window.push_back(it->first);
+            } else if (s.cells.size() != window.size()) {
+                return false; // some iterations touch cells others don't: that's state
+            }
+            output[b] = s.output;
+            for (size_t i = 0; i < window.size(); i++) {
+                map_t::const_iterator it = s.cells.find(window[i]);
+                if (it == s.cells.end()) return false;
+                after[b] += (char)it->second;
+            }
+        }
+        single = identity = true;
+        for (int b = 0; b < 256; b++) {
+            single = single && output[b].size() == 1;
+            identity = identity && single && (unsigned char)output[b][0] == b;
+            table[b] = single ? output[b][0] : 0;
+        }
+        return true;
+    }
+
+    private:
+        typedef map<int, int> map_t;
+        /**
+         * Runs a loop body on a window where only cells the body itself has set are known.
+         */
+        struct Simulation {
+            map_t cells;
+            int pointer;
+            int input;
+            int reads;
+            int steps;
+            string output;
+            Simulation(int b) : pointer(0), input(b), reads(0), steps(0) {}
+            bool known() const {
+                return pointer != 0 && cells.count(pointer);
+            }
+            bool run(const vector<Node*> & nodes) {
+                for (vector<Node*>::const_iterator it = nodes.begin(); it != nodes.end(); ++it) {
+                    if (const Loop * loop = dynamic_cast<const Loop *>(*it)) {
+                        while (true) {
+                            if (!known() || ++steps > STEPS) return false;
+                            if (!cells[pointer]) break;
+                            if (!run(loop->children)) return false;
+                        }
+                        continue;
+                    }
+                    const CommandNode * leaf = static_cast<const CommandNode *>(*it);
+                    switch (leaf->command) {
+                        case SHIFT_LEFT:  pointer -= leaf->count; break;
+                        case SHIFT_RIGHT: pointer += leaf->count; break;
+                        case INCREMENT:
+                        case DECREMENT:
+                            if (!known()) return false;
+                            cells[pointer] = (cells[pointer] + (leaf->command == INCREMENT ? leaf->count : -leaf->count)) & 255;
+                            break;
+                        case ZERO:
+                            if (pointer == 0) return false;
+                            cells[pointer] = 0;
+                            break;
+                        case INPUT:
+                            if (pointer == 0) return false;
+                            reads += leaf->count;
+                            cells[pointer] = input;
+                            break;
+                        case OUTPUT:
+                            if (!known()) return false;
+                            output.append(leaf->count, (char)cells[pointer]);
+                            break;
+                        case TRAP:
+                            return false;
+                    }
+                }
+                return true;
+            }
+        };
+        static const int STEPS = 100000;
+};
+
+/**
+ * Where a loop can reach, if it can only reach so far: it does no I/O, and every pointer move inside it
+ * (nested loops included) comes back where it started. Then all it can read or write is low..high,
+ * as offsets from the loop cell.
+ */
+struct Footprint {
+    int low, high;
+    bool nested; // are there loops inside?
+
+    bool measure(const Loop * loop, int limit = INT_MAX) {
+        low = high = 0;
+        nested = false;
+        int offset = 0;
+        return balanced(loop, offset, limit);
+    }
+
+    private:
+        bool balanced(const Loop * loop, int & offset, int limit) {
+            int start = offset;
+            for (vector<Node*>::const_iterator it = loop->children.begin(); it != loop->children.end(); ++it) {
+                if (const Loop * inner = dynamic_cast<const Loop *>(*it)) {
+                    nested = true;
+                    if (!balanced(inner, offset, limit)) return false;
+                    continue;
+                }
+                const CommandNode * leaf = static_cast<const CommandNode *>(*it);
+                switch (leaf->command) {
+                    case SHIFT_LEFT:  offset -= leaf->count; break;
+                    case SHIFT_RIGHT: offset += leaf->count; break;
+                    case INPUT:
+                    case OUTPUT:      return false;
+                    default:          break;
+                }
+                low = min(low, offset);
+                high = max(high, offset);
+                if (high - low >= limit) return false;
+            }
+            return offset == start;
+        }
+};
+
+/**
+ * A loop worth remembering the results of: one with a Footprint, so the window on the way in decides
+ * the window on the way out, and a table can skip the loop entirely.
+ * Only loops with loops inside qualify; a single flat loop is cheaper to just run than to look up.
+ */
+struct Memo {
+    int low, high; // the window, as offsets from the loop cell
+    int exit;      // where to go on a hit: just past the MEMO_STORE
+
+    static const int WINDOW = 16;
+
+    bool analyze(const Loop * loop) {
+        Footprint f;
+        if (!f.measure(loop, WINDOW) || !f.nested) return false;
+        low = f.low;
+        high = f.high;
+        return true;
+    }
+};
+
+/**
+ * Per-cell amounts for a vector instruction: 16 adjacent cells, updated with one SSE2 add.
+ */
+struct Lanes {
+    static const int WIDTH = 16;
+    alignas(16) unsigned char delta[WIDTH];
+};
+
+inline void addLanes(char * cells, const Lanes & lanes) {
+#ifdef __SSE2__
+    __m128i c = _mm_loadu_si128((const __m128i *)cells);
+    _mm_storeu_si128((__m128i *)cells, _mm_add_epi8(c, _mm_load_si128((const __m128i *)lanes.delta)));
+#else
+    for (int i = 0; i < Lanes::WIDTH; i++) cells[i] += lanes.delta[i];
+#endif
+}
+
+inline void multiplyAddLanes(char * cells, const Lanes & lanes, unsigned char n) {
+#ifdef __SSE2__
+    // SSE2 has no byte multiply: do the even and odd bytes as 16 bit lanes, and keep the low byte of each.
+    __m128i k = _mm_load_si128((const __m128i *)lanes.delta);
+    __m128i times = _mm_set1_epi16(n);
+    __m128i even = _mm_and_si128(_mm_mullo_epi16(k, times), _mm_set1_epi16(0xff));
+    __m128i odd = _mm_slli_epi16(_mm_mullo_epi16(_mm_srli_epi16(k, 8), times), 8);
+    __m128i c = _mm_loadu_si128((const __m128i *)cells);
+    _mm_storeu_si128((__m128i *)cells, _mm_add_epi8(c, _mm_or_si128(even, odd)));
+#else
+    for (int i = 0; i < Lanes::WIDTH; i++) cells[i] += lanes.delta[i] * n;
+#endif
+}
+
+/**
+ * The side tables some instructions index with their arg.
+ */
+struct Tables {
+    vector<Transducer> transducers;
+    vector<Memo> memos;
+    vector<Lanes> lanes;
+};
+
+/**
+ * Lowered code in cache line aligned storage, so the padding the compiler adds actually lines up.
+ * Also remembers where the (first) END is, for runs that have to stop early,
+ * and how far from the pointer any instruction reaches, so the tape can be padded by that much.
+ */
+class Bytecode : public Tables {
+    Bytecode(const Bytecode &);
+    Bytecode & operator=(const Bytecode &);
+    public:
+        Instruction * code;
+        int size;
+        int end;
+        int reach;
+        Bytecode(const vector<Instruction> & lowered, const Tables & tables = Tables())
+            : Tables(tables), size(lowered.size()), end(0), reach(0) {
+            size_t bytes = (size * sizeof(Instruction) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+            code = (Instruction *)aligned_alloc(CACHE_LINE, bytes);
+            copy(lowered.begin(), lowered.end(), code);
+            while (code[end].op != OP_END) end++;
+            for (int i = 0; i < size; i++) {
+                reach = max(reach, abs(code[i].offset));
+                if (code[i].op == OP_ADDV || code[i].op == OP_MULV) {
+                    reach = max(reach, abs(code[i].offset + Lanes::WIDTH - 1));
+                }
+            }
+            for (size_t i = 0; i < transducers.size(); i++) {
+                for (size_t j = 0; j < transducers[i].window.size(); j++) {
+                    reach = max(reach, abs(transducers[i].window[j]));
+                }
+            }
+            for (size_t i = 0; i < memos.size(); i++) {
+                reach = max(reach, max(-memos[i].low, memos[i].high));
+            }
+        }
+        ~Bytecode() {
+            free(code);
+        }
+};
+
+/**
+ * What the compiler wants to know about each loop before it emits it, worked out up front for every loop in the tree.
+ *
+ * These only read the tree, and no loop's answers depend on another's, so on a big program they're shared out
+ * over threads, a loop at a time. Each answer lands in that loop's own slot, so the result (and so the bytecode)
+ * doesn't depend on which thread got there first. Transducer::extract is the expensive one: up to 256 simulations a loop.
+ */
+struct LoopFacts {
+    Transducer * transducer; // null if it isn't one; most loops aren't, and a Transducer is big
+    bool remember;
+    Memo memo;
+};
+
+class Analysis {
+    unordered_map<const Loop *, LoopFacts> facts;
+
+    static void collect(const Container * container, vector<const Loop *> & loops) {
+        for (vector<Node*>::const_iterator it = container->children.begin(); it != container->children.end(); ++it) {
+            if (const Loop * loop = dynamic_cast<const Loop *>(*it)) {
+                loops.push_back(loop);
+                collect(loop, loops);
+            }
+        }
+    }
+    static LoopFacts analyze(const Loop * loop) {
+        LoopFacts f = { NULL, false, Memo() };
+        Transducer * t = new Transducer();
+        if (t->extract(loop)) {
+            f.transducer = t;
+        } else {
+            delete t;
+        }
+        f.remember = f.memo.analyze(loop);
+        return f;
+    }
+    void clear() {
+        for (unordered_map<const Loop *, LoopFacts>::iterator it = facts.begin(); it != facts.end(); ++it) {
+            delete it->second.transducer;
+        }
+        facts.clear();
+    }
+    Analysis(const Analysis &);
+    Analysis & operator=(const Analysis &);
+    public:
+        static const size_t LOOPS_PER_THREAD = 64; // fewer than this each, and starting the threads costs more than it saves
+        Analysis() {}
+        ~Analysis() {
+            clear();
+        }
+        /**
+         * Makes sure every loop in program has its facts. Loops we've seen before (the same Loop objects: --watch reuses
+         * unchanged parts of the tree) keep theirs; loops that aren't in program any more are forgotten.
+         */
+        void run(const Program * program) {
+            vector<const Loop *> loops;
+            collect(program, loops);
+            unordered_map<const Loop *, LoopFacts> kept;
+            vector<const Loop *> fresh;
+            for (size_t i = 0; i < loops.size(); i++) {
+                unordered_map<const Loop *, LoopFacts>::iterator known = facts.find(loops[i]);
+                if (known != facts.end()) {
+                    kept.insert(*known);
+                    facts.erase(known);
+                } else if (!kept.count(loops[i])) {
+                    kept[loops[i]].transducer = NULL; // taken, in case the same loop shows up twice
+                    fresh.push_back(loops[i]);
+                }
+            }
+            clear();
+            facts.swap(kept);
+            vector<LoopFacts> results(fresh.size());
+            size_t workers = min((size_t)max(1u, thread::hardware_concurrency()), fresh.size() / LOOPS_PER_THREAD);
+            if (workers < 2) {
+                for (size_t i = 0; i < fresh.size(); i++) results[i] = analyze(fresh[i]);
+            } else {
+                atomic<size_t> next(0);
+                vector<thread> threads;
+                for (size_t w = 0; w < workers; w++) {
+                    threads.push_back(thread([&]() {
+                        for (size_t i; (i = next++) < fresh.size(); ) results[i] = analyze(fresh[i]);
+                    }));
+                }
+                for (size_t w = 0; w < workers; w++) threads[w].join();
+            }
+            for (size_t i = 0; i < fresh.size(); i++) facts[fresh[i]] = results[i];
+        }
+        const LoopFacts & operator[](const Loop * loop) const {
+            return facts.find(loop)->second;
+        }
+};
+
+/**
+ * Lowers the tree to bytecode, laying it out hot/cold.
+ *
+ * A loop is cold if the profile says its body never ran, or, without a profile, if its cell is known to be zero
+ * when we get there (right after another loop or a [-], or at the very start: the classic comment loop).
+ * Cold loops are moved out of line past the END, so they don't sit between the hot instructions in the cache:
+ * the hot path keeps a single JNZ into the cold copy, which JMPs back when done.
+ *
+ * A loop is hot if it's innermost and either the profile saw it run a lot or there's no profile to ask.
+ * Hot loop bodies get NOP padding (before the JZ, so it runs once per entry, not per iteration) to start on a cache line.
+ *
+ * A loop that would never end once entered becomes a TRAP. parse() already caught the ones that never end whatever
+ * the cell was; here we also know the cell's value sometimes (say +[--] at the start), which catches a few more.
+ */
+class BytecodeCompiler : public Visitor, public Tables {
+    struct ColdLoop {
+        const Loop * loop;
+        int entry; // the JNZ on the hot path to patch
+        int back;  // where to JMP back to
+    };
+    vector<ColdLoop> cold;
+    Analysis own;
+    Analysis * analysis;
+    int offset;     // pointer moves we haven't emitted yet
+    bool known;      // do we know what memory[pointer + knownOffset] is right now?
+    int knownOffset;
+    int knownValue;  // ...and what it is, before any adds still waiting for it
+    int loop;
+    map<int, int> adds; // offset -> amount, for the +/- in the current straight run
+    static const int VECTOR_TARGETS = 4; // cells within one Lanes::WIDTH span before an ADDV/MULV pays off
+    void emit(Opcode op, int arg, int off) {
+        Instruction i = { op, arg, off, loop };
+        code.push_back(i);
+    }
+    void flush() {
+        if (offset) {
+            emit(OP_MOVE, offset, 0);
+            knownOffset -= offset;
+            offset = 0;
+        }
+    }
+    /**
+     * The current cell's value, if we know it; -1 if not.
+     */
+    int cell() const {
+        if (!known || knownOffset != offset) return -1;
+        map<int, int>::const_iterator pending = adds.find(offset);
+        return (knownValue + (pending != adds.end() ? pending->second : 0)) & 255;
+    }
+    bool knownZero() const {
+        return cell() == 0;
+    }
+    /**
+     * Emits per-cell amounts: one vector instruction for each span of Lanes::WIDTH cells with enough of them in it,
+     * single ones for the rest.
+     */
+    void emitLanes(const map<int, int> & amounts, Opcode single, Opcode vector) {
+        map<int, int>::const_iterator it = amounts.begin();
+        while (it != amounts.end()) {
+            map<int, int>::const_iterator last = amounts.lower_bound(it->first + Lanes::WIDTH);
+            int targets = 0;
+            for (map<int, int>::const_iterator j = it; j != last; ++j) {
+                if (j->second & 255) targets++;
+            }
+            if (targets >= VECTOR_TARGETS) {
+                Lanes l = {};
+                for (map<int, int>::const_iterator j = it; j != last; ++j) {
+                    l.delta[j->first - it->first] = j->second;
+                }
+                emit(vector, lanes.size(), it->first);
+                lanes.push_back(l);
+                it = last;
+            } else {
+                if (it->second & 255) emit(single, it->second, it->first);
+                ++it;
+            }
+        }
+    }
+    /**
+     * The +/- of a straight run commute with each other, so they wait here until something reads or writes a cell.
+     */
+    void flushAdds() {
+        if (known && adds.count(knownOffset)) knownValue += adds[knownOffset];
+        emitLanes(adds, OP_ADD, OP_ADDV);
+        adds.clear();
+    }
+    /**
+     * Is this a multiply loop like [->+++>+<<]? Only +-<>, the pointer ends where it started, and the loop cell goes
+     * down (or up) by exactly one a time round. If so, factors gets what every other cell gains per unit of loop cell.
+     */
+    static bool multiplies(const Loop * loop, map<int, int> & factors) {
+        int at = 0;
+        for (vector<Node*>::const_iterator it = loop->children.begin(); it != loop->children.end(); ++it) {
+            const CommandNode * leaf = dynamic_cast<const CommandNode *>(*it);
+            if (!leaf) return false;
+            switch (leaf->command) {
+                case INCREMENT:   factors[at] += leaf->count; break;
+                case DECREMENT:   factors[at] -= leaf->count; break;
+                case SHIFT_LEFT:  at -= leaf->count; break;
+                case SHIFT_RIGHT: at += leaf->count; break;
+                default:          return false;
+            }
+        }
+        int step = factors[0] & 255;
+        if (at != 0 || (step != 1 && step != 255)) return false;
+        factors.erase(0);
+        if (step == 1) {
+            // Counting up from n takes 256 - n rounds, which is -n as far as a byte cares.
+            for (map<int, int>::iterator it = factors.begin(); it != factors.end(); ++it) it->second = -it->second;
+        }
+        return true;
+    }
+    static bool innermost(const Loop * loop) {
+        for (vector<Node*>::const_iterator it = loop->children.begin(); it != loop->children.end(); ++it) {
+            if (dynamic_cast<const Loop *>(*it)) return false;
+        }
+        return true;
+    }
+    bool isCold(const Loop * loop) const {
+        if (loop->profile) {
+            return loop->profile->iterations == 0;
+        }
+        return knownZero();
+    }
+    static bool isHot(const Loop * loop) {
+        if (!innermost(loop)) return false;
+        return !loop->profile || loop->profile->iterations >= HOT_ITERATIONS;
+    }
+    void body(const Loop * l) {
+        int outer = loop;
+        loop = l->id;
+        known = false;
+        for (vector<Node*>::const_iterator it = l->children.begin(); it != l->children.end(); ++it) {
+            (*it)->accept(this);
+        }
+        flushAdds();
+        flush();
+        loop = outer;
+    }
+    void loopExit() {
+        // Whichever way we left, the loop cell is zero now.
+        known = true;
+        knownOffset = 0;
+        knownValue = 0;
+    }
+    public:
+        static const long long HOT_ITERATIONS = 256;
+        vector<Instruction> code;
+        /**
+         * fresh: this is the start of a program, so the whole tape is known to be zero.
+         */
+        /**
+         * analysis: facts kept from lowering an earlier version of the program, if there are any to reuse.
+         */
+        BytecodeCompiler(bool fresh = true, Analysis * shared = NULL)
+            : analysis(shared ? shared : &own), offset(0), known(fresh), knownOffset(0), knownValue(0), loop(-1) {}
+        void visit(const CommandNode * leaf) {
+            switch (leaf->command) {
+                case INCREMENT:   adds[offset] += leaf->count; return;
+                case DECREMENT:   adds[offset] -= leaf->count; return;
+                case SHIFT_LEFT:  offset -= leaf->count; return;
+                case SHIFT_RIGHT: offset += leaf->count; return;
+                case INPUT:       flushAdds(); emit(OP_IN, leaf->count, offset); break;
+                case OUTPUT:      flushAdds(); emit(OP_OUT, leaf->count, offset); return;
+                case ZERO:
+                    flushAdds();
+                    emit(OP_ZERO, 0, offset);
+                    known = true;
+                    knownOffset = offset;
+                    knownValue = 0;
+                    return;
+                case TRAP:
+                    flushAdds();
+                    emit(OP_TRAP, 0, offset);
+                    known = true; // if we're still going, it was zero
+                    knownOffset = offset;
+                    knownValue = 0;
+                    return;
+            }
+            if (knownOffset == offset) known = false;
+        }
+        void visit(const Loop * l) {
+            bool cold = isCold(l);
+            int entry = cell();
+            flushAdds();
+            flush();
+            if (!cold && neverEnds(l, entry)) {
+                emit(OP_TRAP, 0, 0);
+                loopExit();
+                return;
+            }
+            if (cold) {
+                ColdLoop c = { l, (int)code.size(), (int)code.size() + 1 };
+                emit(OP_JNZ, 0, 0);
+                this->cold.push_back(c);
+                loopExit();
+                return;
+            }
+            const LoopFacts & facts = (*analysis)[l];
+            if (facts.transducer) {
+                // Run it as a table while there's input; the loop proper only sees what's left at EOF.
+                emit(OP_TRANSDUCE, transducers.size(), 0);
+                transducers.push_back(*facts.transducer);
+            }
+            map<int, int> factors;
+            if (multiplies(l, factors)) {
+                int head = code.size();
+                emit(OP_JZ, 0, 0);
+                emitLanes(factors, OP_MUL, OP_MULV);
+                emit(OP_ZERO, 0, 0);
+                code[head].arg = code.size();
+                loopExit();
+                return;
+            }
+            if (isHot(l)) {
+                // The body starts right after the JZ; pad until that's the first slot of a line.
+                while ((code.size() + 1) % PER_LINE) {
+                    emit(OP_NOP, 0, 0);
+                }
+            }
+            bool remember = facts.remember;
+            int slot = memos.size();
+            if (remember) {
+                // Take the slot now: memo loops inside the body take theirs while it's lowered.
+                memos.push_back(facts.memo);
+                emit(OP_MEMO, slot, 0);
+            }
+            int head = code.size();
+            emit(OP_JZ, 0, 0);
+            body(l);
+            emit(OP_JNZ, head + 1, 0);
+            code[head].arg = code.size();
+            if (remember) {
+                emit(OP_MEMO_STORE, slot, 0);
+                memos[slot].exit = code.size();
+            }
+            loopExit();
+        }
+        void visit(const Program * program) {
+            analysis->run(program);
+            for (vector<Node*>::const_iterator it = program->children.begin(); it != program->children.end(); ++it) {
+                (*it)->accept(this);
+            }
+            flushAdds();
+            flush(); // a whole program wouldn't care where it stops, but a piece run on a shared tape does
+            emit(OP_END, 0, 0);
+            // Out of line: cold loops (and any cold loops inside them) go after the END.
+            for (size_t i = 0; i < cold.size(); i++) {
+                ColdLoop c = cold[i];
+                int start = code.size();
+                code[c.entry].arg = start;
+                body(c.loop);
+                emit(OP_JNZ, start, 0);
+                emit(OP_JMP, c.back, 0);
+            }
         }
+};
+
+/**
+ * What the bytecode interpreter keeps in registers while it runs.
+ *
+ * Loops are where runs go wrong, so that's where we check: every JZ and JNZ makes sure the pointer is on the tape
+ * (MOVEs only happen right before one, so offsets never reach further than the tape's padding),
+ * and every taken back-edge burns a unit of fuel. A run that has to stop jumps to the END.
+ * Straight-line code can still wander into the padding, so IN, OUT and TRAP check their own cell (that's where it would
+ * show), and the END checks where the pointer finished.
+ */
+struct Machine {
+    char * pointer;
+    char * low;  // first cell of the tape
+    char * high; // one past the last
+    unsigned long long fuel;
+    const Instruction * halt;
+    bf::Status status;
+    int resume; // out of fuel: where the back-edge we didn't take was going
+    inline bool offTape(int offset = 0) const {
+        return pointer + offset < low || pointer + offset >= high;
+    }
+    inline const Instruction * stop(bf::Status why) {
+        status = why;
+        return halt - 1;
+    }
+};
+
+/**
+ * Where a BytecodeInterpreter is up to, for a sampling profiler to read from its signal handler.
+ */
+struct Sampler {
+    const Instruction * volatile at;
+    Sampler() : at(NULL) {}
+};
+
+/**
+ * The pieces superinstructions are made of. Each step does one plain instruction's work on its own operands,
+ * and returns the instruction to continue after (the dispatch loop does the ip++).
+ */
+template <Opcode op> inline const Instruction * step(Machine & m, const Instruction * ip, const Instruction * code);
+template <> inline const Instruction * step<OP_ADD>(Machine & m, const Instruction * ip, const Instruction *) {
+    m.pointer[ip->offset] += ip->arg;
+    return ip;
+}
+template <> inline const Instruction * step<OP_MOVE>(Machine & m, const Instruction * ip, const Instruction *) {
+    m.pointer += ip->arg;
+    return ip;
+}
+template <> inline const Instruction * step<OP_ZERO>(Machine & m, const Instruction * ip, const Instruction *) {
+    m.pointer[ip->offset] = 0;
+    return ip;
+}
+template <> inline const Instruction * step<OP_JZ>(Machine & m, const Instruction * ip, const Instruction * code) {
+    if (m.offTape()) return m.stop(bf::OUT_OF_TAPE);
+    return *m.pointer ? ip : code + ip->arg - 1;
+}
+template <> inline const Instruction * step<OP_JNZ>(Machine & m, const Instruction * ip, const Instruction * code) {
+    if (m.offTape()) return m.stop(bf::OUT_OF_TAPE);
+    if (!*m.pointer) return ip;
+    if (!m.fuel) {
+        m.resume = ip->arg;
+        return m.stop(bf::OUT_OF_FUEL);
+    }
+    m.fuel--;
+    return code + ip->arg - 1;
+}
+
+template <Opcode a, Opcode b> inline const Instruction * fused(Machine & m, const Instruction * ip, const Instruction * code) {
+    step<a>(m, ip, code);
+    return step<b>(m, ip + 1, code);
+}
+template <Opcode a, Opcode b, Opcode c> inline const Instruction * fused(Machine & m, const Instruction * ip, const Instruction * code) {
+    step<a>(m, ip, code);
+    step<b>(m, ip + 1, code);
+    return step<c>(m, ip + 2, code);
+}
+
+/**
+ * Rewrites the head of every superinstruction-shaped run to the fused opcode, trying triples before pairs.
+ * The instructions after the head keep their own opcodes and operands: the fused handler reads them,
+ * and a jump that lands in the middle of a group still finds plain instructions there.
+ */
+void fuse(vector<Instruction> & code) {
+    for (size_t i = 0; i < code.size(); i++) {
+        Opcode a = code[i].op;
+        Opcode b = i + 1 < code.size() ? code[i + 1].op : OP_END;
+        Opcode c = i + 2 < code.size() ? code[i + 2].op : OP_END;
+#define PAIR(x, y)
+#define TRIPLE(x, y, z) if (a == OP_##x && b == OP_##y && c == OP_##z) { code[i].op = OP_##x##_##y##_##z; i += 2; continue; }
+        SUPERINSTRUCTIONS(PAIR, TRIPLE)
+#undef PAIR
+#undef TRIPLE
+#define PAIR(x, y) if (a == OP_##x && b == OP_##y) { code[i].op = OP_##x##_##y; i += 1; continue; }
+#define TRIPLE(x, y, z)
+        SUPERINSTRUCTIONS(PAIR, TRIPLE)
+#undef PAIR
+#undef TRIPLE
     }
 }
+
+#if !defined(BRAINFUCK_FAST_START) && !defined(BRAINFUCK_LIBRARY)
+
+/**
+ * Prints the most frequent opcode pairs and triples in lowered (unfused) code, to pick superinstructions from.
+ * With a profile, each instruction counts as often as its innermost loop's body ran; without, once per occurrence.
+ */
+void opcodeStats(const vector<Instruction> & code, const Profile * profile, ostream & out) {
+    map<string, long long> counts;
+    for (size_t i = 0; i < code.size(); i++) {
+        long long weight = 1;
+        if (profile && code[i].loop >= 0 && code[i].loop < (int)profile->loops.size()) {
+            weight = profile->loops[code[i].loop].iterations;
+        }
+        if (code[i].op == OP_NOP) {
+            continue;
+        }
+        string sequence = opcodeNames[code[i].op];
+        for (size_t j = i + 1; j < code.size() && j < i + 3; j++) {
+            Opcode previous = code[j - 1].op;
+            if (previous == OP_JNZ || previous == OP_JMP || previous == OP_END || code[j].op == OP_NOP) {
+                break; // what comes next in the layout isn't what runs next
+            }
+            sequence += string(" ") + opcodeNames[code[j].op];
+            counts[sequence] += weight;
+        }
+    }
+    vector<pair<long long, string> > ranked;
+    for (map<string, long long>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+        ranked.push_back(make_pair(it->second, it->first));
+    }
+    sort(ranked.rbegin(), ranked.rend());
+    for (size_t i = 0; i < ranked.size() && i < 20; i++) {
+        out << ranked[i].first << '\t' << ranked[i].second << '\n';
+    }
+}
+
+#endif
+
+/**
+ * How long input waits for its answer: from when a read brings a byte in, to when the output produced after it
+ * goes out (which the BytecodeInterpreter does when it's about to wait for more input, or its buffer fills).
+ * Bytes the program reads without writing anything before the next read don't count.
+ *
+ * Latencies are in nanoseconds, in log-linear buckets HDR-style: exact below 128, then 64 buckets per power of two,
+ * so anything reported is within about 1.5% of the truth. It covers everything a 64-bit count of nanoseconds can hold
+ * in under 4K buckets.
+ */
+class Latencies {
+    static const int SUB = 64;
+    vector<unsigned long long> buckets;
+    unsigned long long count;
+    unsigned long long longest;
+    long long arrival;        // when the bytes from pending on came in
+    const char * pending;     // the first byte read since the last answer
+    bf::Sink * sink;
+    static long long now() {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec * 1000000000LL + t.tv_nsec;
+    }
+    static int bucket(unsigned long long v) {
+        if (v < 2 * SUB) return v;
+        int shift = 63 - __builtin_clzll(v) - 6;
+        return SUB * shift + (v >> shift);
+    }
+    void poll() {
+        if (wanted) {
+            wanted = 0;
+            report();
+        }
+    }
+    static unsigned long long lowest(int b) {
+        if (b < 2 * SUB) return b;
+        int shift = b / SUB - 1;
+        return (unsigned long long)(b - SUB * shift) << shift;
+    }
+    public:
+        volatile sig_atomic_t wanted; // set (say from a signal handler) to have report() called at the next read or write
+        Latencies(bf::Sink * s) : buckets(SUB * 60, 0), count(0), longest(0), arrival(0), pending(NULL), sink(s), wanted(0) {}
+        void arrived(const char * at) {
+            arrival = now();
+            pending = at;
+            poll();
+        }
+        void answered(const char * upTo) {
+            if (pending && upTo > pending) {
+                unsigned long long took = max(now() - arrival, 0LL);
+                buckets[bucket(took)] += upTo - pending;
+                count += upTo - pending;
+                longest = max(longest, took);
+                pending = upTo;
+            }
+            poll();
+        }
+        /**
+         * The smallest latency that q of the bytes came in under (as the bottom of its bucket).
+         */
+        unsigned long long quantile(double q) const {
+            unsigned long long seen = 0, need = (unsigned long long)(q * count);
+            for (size_t b = 0; b < buckets.size(); b++) {
+                seen += buckets[b];
+                if (seen > need) return lowest(b);
+            }
+            return longest;
+        }
+        void report() {
+            char line[256];
+            int n = snprintf(line, sizeof(line),
+                             "[latency: %llu bytes, p50 %lluus, p90 %lluus, p99 %lluus, p99.9 %lluus, max %lluus]\n",
+                             count, quantile(0.5) / 1000, quantile(0.9) / 1000, quantile(0.99) / 1000,
+                             quantile(0.999) / 1000, longest / 1000);
+            sink->write(line, n);
+        }
+};
+
+/**
+ * Runs lowered bytecode, on the same sort of tape as the Interpreter visitor, but with I/O through a bf::Source
+ * and bf::Sink instead of cin and cout. Output is buffered, and flushed whenever we're about to wait for input.
+ * Reuse one for many runs and it keeps its tape allocation.
+ */
+class BytecodeInterpreter {
+    vector<char> tape;
+    char inputBuffer[4096];
+    char outputBuffer[4096];
+    const char * in;
+    const char * inEnd;
+    bf::Source * source;
+    char * out;
+    bf::Sink * sink;
+    size_t written;
+    size_t outputLimit;
+    /**
+     * What the memo loops have learned so far. This lives here rather than in the Bytecode, which is shared
+     * between threads; a batch on one interpreter keeps learning from job to job.
+     * A table that isn't getting hits switches itself off.
+     */
+    struct MemoTable {
+        unordered_map<string, string> results;
+        string key; // the window on the way in, while the loop runs
+        bool running;
+        bool off;
+        long long lookups, hits;
+        MemoTable() : running(false), off(false), lookups(0), hits(0) {}
+    };
+    static const long long MEMO_CHECK = 1024;   // judge the hit rate every this many lookups
+    static const size_t MEMO_ENTRIES = 1 << 16; // stop learning past this
+    vector<MemoTable> memos;
+    void flush() {
+        if (out != outputBuffer) {
+            sink->write(outputBuffer, out - outputBuffer);
+            out = outputBuffer;
+            if (latencies) latencies->answered(in);
+        }
+    }
+    bool refill() {
+        if (!source) return false;
+        flush();
+        size_t n = source->read(inputBuffer, sizeof(inputBuffer));
+        in = inputBuffer;
+        inEnd = inputBuffer + n;
+        if (latencies) latencies->arrived(in);
+        return n > 0;
+    }
+    /**
+     * Pushes bytes through a transducer for as long as there's input, fuel and output allowance;
+     * whatever's left (EOF, mostly) the loop itself deals with.
+     */
+    void transduce(const Transducer & t, Machine & m) {
+        if (!*m.pointer) return;
+        int last = -1;
+        while ((in < inEnd || refill()) && m.fuel) {
+            size_t n = min((size_t)(inEnd - in), (size_t)min(m.fuel, (unsigned long long)SIZE_MAX));
+            if (t.single) {
+                n = min(n, outputLimit - written);
+                if (!n) break;
+                written += n;
+                m.fuel -= n;
+                last = (unsigned char)in[n - 1];
+                const char * stop = in + n;
+                while (in < stop) {
+                    size_t room = outputBuffer + sizeof(outputBuffer) - out;
+                    size_t chunk = min((size_t)(stop - in), room);
+                    if (t.identity) {
+                        memcpy(out, in, chunk);
+                    } else {
+                        for (size_t i = 0; i < chunk; i++) out[i] = t.table[(unsigned char)in[i]];
+                    }
+                    out += chunk;
+                    in += chunk;
+                    if (out == outputBuffer + sizeof(outputBuffer)) flush();
+                }
+            } else {
+                const string & o = t.output[(unsigned char)*in];
+                if (written + o.size() > outputLimit) break;
+                written += o.size();
+                m.fuel--;
+                last = (unsigned char)*in++;
+                for (size_t i = 0; i < o.size(); i++) {
+                    if (out == outputBuffer + sizeof(outputBuffer)) flush();
+                    *out++ = o[i];
+                }
+            }
+        }
+        if (last >= 0) {
+            for (size_t i = 0; i < t.window.size(); i++) {
+                m.pointer[t.window[i]] = t.after[last][i];
+            }
+        }
+    }
+    // Where a sliced run (begin() and slice()) is up to.
+    const Bytecode * running;
+    char * pointer;
+    unsigned long long fuelLeft;
+    int resumeAt;
+
+    void limit(const bf::Limits & limits) {
+        out = outputBuffer;
+        written = 0;
+        outputLimit = limits.output ? limits.output : SIZE_MAX;
+    }
+    bf::Status fresh(const Bytecode & bytecode, const bf::Limits & limits, bool warm) {
+        tape.assign(TAPE + 2 * bytecode.reach, 0);
+        char * pointer = &tape[bytecode.reach];
+        limit(limits);
+        return execute(bytecode, pointer, pointer + TAPE, pointer, limits.fuel, 0, warm);
+    }
+    /**
+     * Runs from instruction from until the END, or until the fuel runs out (fuel 0 is no limit).
+     * With a sampler there's a store per instruction, so that's a separate copy of the loop; without one it costs nothing.
+     */
+    bf::Status execute(const Bytecode & bytecode, char * low, char * high, char *& pointer, unsigned long long fuel, int from, bool warm) {
+        if (!sampler) return execute<false>(bytecode, low, high, pointer, fuel, from, warm);
+        return execute<true>(bytecode, low, high, pointer, fuel, from, warm);
+    }
+    template <bool sampled>
+    bf::Status execute(const Bytecode & bytecode, char * low, char * high, char *& pointer, unsigned long long fuel, int from, bool warm) {
+        const Instruction * code = bytecode.code;
+        if (!warm) {
+            memos.assign(bytecode.memos.size(), MemoTable());
+        }
+        for (size_t i = 0; i < memos.size(); i++) {
+            memos[i].running = false;
+        }
+        Machine m;
+        m.low = low;
+        m.high = high;
+        m.pointer = pointer;
+        m.fuel = fuel ? fuel : ULLONG_MAX;
+        if (from) m.fuel--; // picking up at a back-edge the last slice ran out before taking: it's this slice's
+        m.halt = code + bytecode.end;
+        m.status = bf::OK;
+        m.resume = 0;
+        for (const Instruction * ip = code + from; ; ip++) {
+            if (sampled) sampler->at = ip;
+            switch (ip->op) {
+                case OP_ADD:  ip = step<OP_ADD>(m, ip, code); break;
+                case OP_MOVE: ip = step<OP_MOVE>(m, ip, code); break;
+                case OP_ZERO: ip = step<OP_ZERO>(m, ip, code); break;
+                case OP_MUL:  m.pointer[ip->offset] += ip->arg * *m.pointer; break;
+                case OP_ADDV: addLanes(m.pointer + ip->offset, bytecode.lanes[ip->arg]); break;
+                case OP_MULV: multiplyAddLanes(m.pointer + ip->offset, bytecode.lanes[ip->arg], *m.pointer); break;
+                case OP_IN:
+                    if (m.offTape(ip->offset)) {
+                        ip = m.stop(bf::OUT_OF_TAPE);
+                        break;
+                    }
+                    for (int i = 0; i < ip->arg; i++) {
+                        if (in == inEnd && !refill()) break; // EOF: leave the cell alone
+                        m.pointer[ip->offset] = *in++;
+                    }
+                    break;
+                case OP_OUT:
+                    if (m.offTape(ip->offset)) {
+                        ip = m.stop(bf::OUT_OF_TAPE);
+                        break;
+                    }
+                    if (written + ip->arg > outputLimit) {
+                        ip = m.stop(bf::OUT_OF_OUTPUT);
+                        break;
+                    }
+                    written += ip->arg;
+                    for (int i = 0; i < ip->arg; i++) {
+                        if (out == outputBuffer + sizeof(outputBuffer)) flush();
+                        *out++ = m.pointer[ip->offset];
+                    }
+                    break;
+                case OP_JZ:   ip = step<OP_JZ>(m, ip, code); break;
+                case OP_JNZ:  ip = step<OP_JNZ>(m, ip, code); break;
+                case OP_JMP:  ip = code + ip->arg - 1; break;
+                case OP_NOP:  break;
+                case OP_TRANSDUCE:
+                    if (m.offTape()) {
+                        ip = m.stop(bf::OUT_OF_TAPE);
+                        break;
+                    }
+                    transduce(bytecode.transducers[ip->arg], m);
+                    break;
+                case OP_MEMO: {
+                    if (m.offTape()) {
+                        ip = m.stop(bf::OUT_OF_TAPE);
+                        break;
+                    }
+                    MemoTable & t = memos[ip->arg];
+                    if (!*m.pointer || t.off) break;
+                    const Memo & memo = bytecode.memos[ip->arg];
+                    t.key.assign(m.pointer + memo.low, memo.high - memo.low + 1);
+                    unordered_map<string, string>::const_iterator hit = t.results.find(t.key);
+                    t.lookups++;
+                    if (hit != t.results.end()) {
+                        t.hits++;
+                        memcpy(m.pointer + memo.low, hit->second.data(), hit->second.size());
+                        ip = code + memo.exit - 1;
+                    } else if (t.lookups % MEMO_CHECK == 0 && t.hits * 4 < t.lookups) {
+                        t.off = true; // under 25% hits: not worth the lookups
+                        t.results.clear();
+                    } else {
+                        t.running = true;
+                    }
+                    break;
+                }
+                case OP_MEMO_STORE: {
+                    MemoTable & t = memos[ip->arg];
+                    if (!t.running) break;
+                    t.running = false;
+                    if (t.results.size() < MEMO_ENTRIES) {
+                        const Memo & memo = bytecode.memos[ip->arg];
+                        t.results[t.key].assign(m.pointer + memo.low, memo.high - memo.low + 1);
+                    }
+                    break;
+                }
+                case OP_TRAP:
+                    if (m.offTape(ip->offset)) {
+                        ip = m.stop(bf::OUT_OF_TAPE);
+                    } else if (m.pointer[ip->offset]) {
+                        ip = m.stop(bf::NEVER_ENDS);
+                    }
+                    break;
+                case OP_END:
+                    if (m.status == bf::OK && m.offTape()) m.status = bf::OUT_OF_TAPE;
+                    flush();
+                    iterations += (fuel ? fuel : ULLONG_MAX) - m.fuel;
+                    if (sampled) sampler->at = NULL;
+                    pointer = m.pointer;
+                    resumeAt = m.resume;
+                    return m.status;
+#define PAIR(a, b) case OP_##a##_##b: ip = fused<OP_##a, OP_##b>(m, ip, code); break;
+#define TRIPLE(a, b, c) case OP_##a##_##b##_##c: ip = fused<OP_##a, OP_##b, OP_##c>(m, ip, code); break;
+                SUPERINSTRUCTIONS(PAIR, TRIPLE)
+#undef PAIR
+#undef TRIPLE
+                case OP_COUNT: break;
+            }
+        }
+    }
+    public:
+        static const size_t TAPE = 30000;
+        Sampler * sampler; // if set, kept up to date with the instruction we're on
+        Latencies * latencies; // if set, told when input comes in and output goes out
+        unsigned long long iterations; // loop back-edges taken, over every run so far
+        BytecodeInterpreter()
+            : in(NULL), inEnd(NULL), source(NULL), out(outputBuffer), sink(NULL), written(0), outputLimit(0),
+              running(NULL), pointer(NULL), fuelLeft(0), resumeAt(0), sampler(NULL), latencies(NULL), iterations(0) {}
+        /**
+         * warm keeps what the memo tables learned on the previous run, which must have been of the same bytecode.
+         */
+        bf::Status run(const Bytecode & bytecode, const char * input, size_t length, bf::Sink * output, const bf::Limits & limits, bool warm = false) {
+            in = input;
+            inEnd = input + length;
+            source = NULL;
+            sink = output;
+            return fresh(bytecode, limits, warm);
+        }
+        bf::Status run(const Bytecode & bytecode, bf::Source * input, bf::Sink * output, const bf::Limits & limits) {
+            in = inEnd = NULL;
+            source = input;
+            sink = output;
+            return fresh(bytecode, limits, false);
+        }
+        /**
+         * Runs on someone else's tape, which needs bytecode.reach cells of padding either side of [low, high).
+         * Starts at pointer and leaves it wherever the code did. Input already buffered from the same source carries over,
+         * so a program can be run in pieces.
+         */
+        bf::Status run(const Bytecode & bytecode, char * low, char * high, char *& pointer, bf::Source * input, bf::Sink * output, const bf::Limits & limits) {
+            if (input != source) {
+                in = inEnd = NULL;
+                source = input;
+            }
+            sink = output;
+            limit(limits);
+            return execute(bytecode, low, high, pointer, limits.fuel, 0, false);
+        }
+        /**
+         * A run in slices, for sharing a thread: begin() sets it up, then each slice() runs it for up to n loop
+         * back-edges. slice() returns true once the run is over (with how it went in status), false if it's only
+         * paused; the next slice() picks up at the back-edge it stopped at. Limits cover the whole run, not each slice.
+         */
+        void begin(const Bytecode & bytecode, bf::Source * input, bf::Sink * output, const bf::Limits & limits) {
+            in = inEnd = NULL;
+            source = input;
+            sink = output;
+            running = &bytecode;
+            tape.assign(TAPE + 2 * bytecode.reach, 0);
+            pointer = &tape[bytecode.reach];
+            limit(limits);
+            fuelLeft = limits.fuel ? limits.fuel : ULLONG_MAX;
+            resumeAt = 0;
+            memos.assign(bytecode.memos.size(), MemoTable());
+        }
+        bool slice(unsigned long long n, bf::Status & status) {
+            unsigned long long fuel = min(n, fuelLeft);
+            char * low = &tape[running->reach];
+            status = execute(*running, low, low + TAPE, pointer, fuel, resumeAt, true);
+            if (status != bf::OUT_OF_FUEL) return true;
+            if (fuelLeft != ULLONG_MAX) fuelLeft -= fuel;
+            return !fuelLeft;
+        }
+};
+
+/**
+ * --direct: runs the source text itself. No tree, no passes, no bytecode: one pass over the source fills in a table,
+ * and then the interpreter reads the source bytes as it goes. For programs so small that getting them ready
+ * costs more than running them.
+ *
+ * The table has, for each bracket, where its partner is; for the first of a run of +, -, < or >, how long the run is
+ * (so it's one step, not one per character); and for the first of a run of comment characters, how many to skip.
+ * Brackets that don't match go the way parse() takes them: a stray ']' ends the program there,
+ * and a '[' that's still open at the end gets closed there.
+ */
+class DirectInterpreter {
+    vector<int> table;
+    int end;      // where the program stops: the end of the source, or a stray ']'
+    int closers;  // unclosed '['s, closed by pretend ']'s from end on
+    static bool command(char c) {
+        return c == '+' || c == '-' || c == '<' || c == '>' || c == ',' || c == '.' || c == '[' || c == ']';
+    }
+    void scan(const char * source, int length) {
+        table.assign(length, 0);
+        vector<int> open;
+        end = length;
+        for (int i = 0; i < length; ) {
+            char c = source[i];
+            if (c == '[') {
+                open.push_back(i++);
+            } else if (c == ']') {
+                if (open.empty()) {
+                    end = i;
+                    break;
+                }
+                table[i] = open.back();
+                table[open.back()] = i;
+                open.pop_back();
+                i++;
+            } else {
+                int run = 1;
+                bool isCommand = command(c);
+                while (i + run < length && (isCommand ? source[i + run] == c : !command(source[i + run]))) run++;
+                table[i] = run;
+                i += run;
+            }
+        }
+        closers = open.size();
+        table.resize(end + closers);
+        for (int i = 0; i < closers; i++) {
+            int at = end + closers - 1 - i; // the innermost open bracket gets the first closer
+            table[at] = open[open.size() - 1 - i];
+            table[open[open.size() - 1 - i]] = at;
+        }
+    }
+    public:
+        static const int TAPE = 30000;
+        bf::Status run(const char * source, size_t length, bf::Source * input, bf::Sink * output) {
+            scan(source, length);
+            char tape[TAPE] = {};
+            char inputBuffer[4096];
+            char outputBuffer[4096];
+            const char * in = inputBuffer;
+            const char * inEnd = inputBuffer;
+            char * out = outputBuffer;
+            int pointer = 0;
+            bf::Status status = bf::OK;
+            for (int i = 0, stop = end + closers; i < stop; ) {
+                char c = i < end ? source[i] : ']';
+                switch (c) {
+                    case '+': tape[pointer] += table[i]; i += table[i]; break;
+                    case '-': tape[pointer] -= table[i]; i += table[i]; break;
+                    case '>':
+                    case '<':
+                        pointer += c == '>' ? table[i] : -table[i];
+                        i += table[i];
+                        if (pointer < 0 || pointer >= TAPE) {
+                            status = bf::OUT_OF_TAPE;
+                            i = stop;
+                        }
+                        break;
+                    case ',':
+                        for (int n = table[i]; n; n--) {
+                            if (in == inEnd) {
+                                output->write(outputBuffer, out - outputBuffer);
+                                out = outputBuffer;
+                                in = inputBuffer;
+                                inEnd = inputBuffer + input->read(inputBuffer, sizeof(inputBuffer));
+                                if (in == inEnd) break; // EOF: leave the cell alone
+                            }
+                            tape[pointer] = *in++;
+                        }
+                        i += table[i];
+                        break;
+                    case '.':
+                        for (int n = table[i]; n; n--) {
+                            if (out == outputBuffer + sizeof(outputBuffer)) {
+                                output->write(outputBuffer, sizeof(outputBuffer));
+                                out = outputBuffer;
+                            }
+                            *out++ = tape[pointer];
+                        }
+                        i += table[i];
+                        break;
+                    case '[': i = tape[pointer] ? i + 1 : table[i] + 1; break;
+                    case ']': i = tape[pointer] ? table[i] + 1 : i + 1; break;
+                    default:  i += table[i]; break;
+                }
+            }
+            output->write(outputBuffer, out - outputBuffer);
+            return status;
+        }
+};
+
+/**
+ * Everything between a parsed tree and something the BytecodeInterpreter can run.
+ */
+Bytecode * lower(const Program & program, bool fresh = true, Analysis * analysis = NULL) {
+    BytecodeCompiler lowering(fresh, analysis);
+    const_cast<Program &>(program).accept(&lowering);
+    fuse(lowering.code);
+    return new Bytecode(lowering.code, lowering);
+}
+
+/**
+ * The library side (see brainfuck.h): the same pipeline as the command line, minus the command line.
+ */
+struct bf::Compiled {
+    Bytecode * bytecode;
+    Compiled(Bytecode * b) : bytecode(b) {}
+    ~Compiled() {
+        delete bytecode;
+    }
+};
+
+bf::Compiled * bf::compile(const char * source, size_t length) {
+    Program program;
+    LoopNumberer numberer;
+    parse(source, source + length, &program);
+    program.accept(&numberer);
+    return new Compiled(lower(program));
+}
+
+void bf::release(bf::Compiled * program) {
+    delete program;
+}
+
+bf::Status bf::run(const bf::Compiled * program, const char * input, size_t length, bf::Sink * output, const bf::Limits & limits) {
+    BytecodeInterpreter vm;
+    return vm.run(*program->bytecode, input, length, output, limits);
+}
+
+bf::Status bf::run(const bf::Compiled * program, bf::Source * input, bf::Sink * output, const bf::Limits & limits) {
+    BytecodeInterpreter vm;
+    return vm.run(*program->bytecode, input, output, limits);
+}
+
+void bf::run(const bf::Compiled * program, bf::Job * jobs, size_t count, const bf::Limits & limits) {
+    BytecodeInterpreter vm;
+    for (size_t i = 0; i < count; i++) {
+        jobs[i].status = vm.run(*program->bytecode, jobs[i].input, jobs[i].length, jobs[i].output, limits, i > 0);
+    }
+}
+
+/**
+ * The Scheduler's insides. A Context is an Instance plus the interpreter holding its place (tape, pointer,
+ * buffered I/O, fuel left). The interpreter only exists once the instance has had its first slice,
+ * so the ones still waiting to start don't each hold a tape.
+ */
+struct Context {
+    bf::Instance * instance;
+    BytecodeInterpreter * vm;
+};
+
+struct bf::Scheduler::State {
+    struct Queue {
+        mutex lock;
+        deque<Context> contexts; // the owner takes from the front and puts back at the back; thieves take from the back
+    };
+    vector<Queue *> queues;
+    vector<thread> threads;
+    unsigned long long slice;
+    mutex lock;              // guards everything from here down
+    condition_variable wake; // something got queued, or we're stopping
+    condition_variable idle; // nothing's unfinished
+    size_t queued;           // contexts in queues, all told
+    size_t unfinished;       // spawned and not finished yet
+    size_t next;             // the queue the next spawn goes on
+    bool stopping;
+
+    bool take(size_t self, Context & c) {
+        for (size_t i = 0; i < queues.size(); i++) {
+            Queue & q = *queues[(self + i) % queues.size()];
+            lock_guard<mutex> hold(q.lock);
+            if (q.contexts.empty()) continue;
+            if (i == 0) {
+                c = q.contexts.front();
+                q.contexts.pop_front();
+            } else {
+                c = q.contexts.back();
+                q.contexts.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+    void put(size_t queue, const Context & c) {
+        {
+            lock_guard<mutex> hold(queues[queue]->lock);
+            queues[queue]->contexts.push_back(c);
+        }
+        lock_guard<mutex> hold(lock);
+        queued++;
+        wake.notify_one();
+    }
+    void work(size_t self) {
+        Context c;
+        while (true) {
+            if (!take(self, c)) {
+                unique_lock<mutex> hold(lock);
+                if (stopping) return;
+                if (!queued) wake.wait(hold);
+                continue;
+            }
+            {
+                lock_guard<mutex> hold(lock);
+                queued--;
+            }
+            bf::Instance * instance = c.instance;
+            if (!c.vm) {
+                c.vm = new BytecodeInterpreter();
+                c.vm->begin(*instance->program->bytecode, instance->input, instance->output, instance->limits);
+            }
+            bf::Status status;
+            if (!c.vm->slice(slice, status)) {
+                put(self, c);
+                continue;
+            }
+            delete c.vm;
+            instance->status = status;
+            instance->finished();
+            lock_guard<mutex> hold(lock);
+            if (!--unfinished) idle.notify_all();
+        }
+    }
+};
+
+bf::Scheduler::Scheduler(size_t threads, unsigned long long slice) : state(new State()) {
+    if (!threads) threads = max(1u, thread::hardware_concurrency());
+    state->slice = slice ? slice : 1;
+    state->queued = state->unfinished = state->next = 0;
+    state->stopping = false;
+    for (size_t i = 0; i < threads; i++) state->queues.push_back(new State::Queue());
+    for (size_t i = 0; i < threads; i++) state->threads.push_back(thread(&State::work, state, i));
+}
+
+bf::Scheduler::~Scheduler() {
+    wait();
+    {
+        lock_guard<mutex> hold(state->lock);
+        state->stopping = true;
+        state->wake.notify_all();
+    }
+    for (size_t i = 0; i < state->threads.size(); i++) state->threads[i].join();
+    for (size_t i = 0; i < state->queues.size(); i++) delete state->queues[i];
+    delete state;
+}
+
+void bf::Scheduler::spawn(bf::Instance * instance) {
+    size_t queue;
+    {
+        lock_guard<mutex> hold(state->lock);
+        state->unfinished++;
+        queue = state->next++ % state->queues.size();
+    }
+    Context c = { instance, NULL };
+    state->put(queue, c);
+}
+
+void bf::Scheduler::wait() {
+    unique_lock<mutex> hold(state->lock);
+    while (state->unfinished) state->idle.wait(hold);
+}
+
+/**
+ * --parallel: runs independent top-level loops at the same time.
+ *
+ * The top level gets cut into tasks: a loop with a Footprint, plus the straight-line, I/O-free commands leading up to it.
+ * Between two stretches of I/O or unbalanced loops the pointer only moves by amounts we know, so we know where every task
+ * starts and what cells it can touch (its footprint, and whatever its lowered code's vector ops reach past that). Consecutive tasks whose cells don't overlap make a group, and a group runs on worker
+ * threads; everything else runs in order on this thread, on the same tape.
+ *
+ * Nothing's speculative: the footprints prove the tasks can't see each other. What we do check at run time is that every
+ * task in a group fits on the tape. If one doesn't, the group runs in order instead, so the error comes out where it would have.
+ * Limits apply to each task on its own.
+ */
+class ParallelRunner {
+    struct Task {
+        vector<Node*> nodes;
+        int start;     // where the pointer is when the task starts, from where the group starts
+        int low, high; // the cells it touches, from where the group starts
+        int end;       // where it leaves the pointer (at its loop), from where the group starts
+        bool heavy;    // has a loop inside its loop: worth a thread
+        Bytecode * code;
+    };
+    struct Step {
+        Bytecode * sequential; // run this in order, or...
+        vector<Task> tasks;    // ...run these at once
+        int end;               // and then the pointer is here, from where the group started
+    };
+    vector<Step> steps;
+    vector<Node*> pending;  // commands leading up to the next task's loop
+    vector<Node*> ordered;  // nodes waiting to run in order
+    vector<Task> group;
+    int at;                 // pointer offset since the last thing we couldn't follow
+    int taskStart, taskLow, taskHigh;
+    int reach;
+
+    static Bytecode * lowerNodes(const vector<Node*> & nodes) {
+        Program fragment;
+        fragment.children = nodes;
+        Bytecode * code = lower(fragment, false);
+        fragment.children.clear(); // still owned by the real program
+        return code;
+    }
+    void touch(int cell) {
+        taskLow = min(taskLow, cell);
+        taskHigh = max(taskHigh, cell);
+    }
+    /**
+     * An ADDV or MULV loads and stores a whole Lanes::WIDTH cells from the one it starts at, which is one the task
+     * touches, so up to Lanes::WIDTH - 1 cells past its highest are the task's too. Code without them stays put.
+     */
+    static bool vectored(const Bytecode & code) {
+        for (int i = 0; i < code.size; i++) {
+            if (code.code[i].op == OP_ADDV || code.code[i].op == OP_MULV) return true;
+        }
+        return false;
+    }
+    void flushOrdered() {
+        if (ordered.empty()) return;
+        Step step = { lowerNodes(ordered), vector<Task>(), 0 };
+        reach = max(reach, step.sequential->reach);
+        steps.push_back(step);
+        ordered.clear();
+    }
+    void flushGroup() {
+        int heavy = 0;
+        for (size_t i = 0; i < group.size(); i++) heavy += group[i].heavy;
+        if (heavy < 2) {
+            // Not worth the threads.
+            for (size_t i = 0; i < group.size(); i++) {
+                ordered.insert(ordered.end(), group[i].nodes.begin(), group[i].nodes.end());
+                delete group[i].code;
+            }
+        } else {
+            flushOrdered();
+            Step step = { NULL, group, 0 };
+            int base = group.front().start;
+            for (size_t i = 0; i < step.tasks.size(); i++) {
+                Task & t = step.tasks[i];
+                t.start -= base;
+                t.low -= base;
+                t.high -= base;
+                t.end -= base;
+                reach = max(reach, t.code->reach);
+            }
+            step.end = group.back().end - base;
+            steps.push_back(step);
+        }
+        group.clear();
+    }
+    bool overlaps(int low, int high) const {
+        for (size_t i = 0; i < group.size(); i++) {
+            if (low <= group[i].high && group[i].low <= high) return true;
+        }
+        return false;
+    }
+    static bool followable(const Node * node, Footprint & f) {
+        if (const Loop * loop = dynamic_cast<const Loop *>(node)) {
+            return f.measure(loop);
+        }
+        Command c = static_cast<const CommandNode *>(node)->command;
+        return c != INPUT && c != OUTPUT && c != TRAP;
+    }
+    void add(Node * node) {
+        const Loop * loop = dynamic_cast<const Loop *>(node);
+        Footprint f;
+        if (!followable(node, f)) {
+            // Lost track of the pointer (or there's I/O): whatever we had runs first, in order.
+            flushGroup();
+            ordered.insert(ordered.end(), pending.begin(), pending.end());
+            pending.clear();
+            ordered.push_back(node);
+            at = 0;
+            return;
+        }
+        if (pending.empty()) {
+            taskStart = at;
+            taskLow = INT_MAX;
+            taskHigh = INT_MIN;
+        }
+        pending.push_back(node);
+        if (!loop) {
+            const CommandNode * leaf = static_cast<const CommandNode *>(node);
+            switch (leaf->command) {
+                case SHIFT_LEFT:  at -= leaf->count; break;
+                case SHIFT_RIGHT: at += leaf->count; break;
+                default:          touch(at); break;
+            }
+            return;
+        }
+        touch(at + f.low);
+        touch(at + f.high);
+        Bytecode * code = lowerNodes(pending);
+        if (vectored(*code)) taskHigh += Lanes::WIDTH - 1;
+        if (overlaps(taskLow, taskHigh)) {
+            flushGroup();
+        }
+        bool heavy = f.nested || (loop->profile && loop->profile->iterations >= HEAVY_ITERATIONS);
+        Task t = { pending, taskStart, taskLow, taskHigh, at, heavy, code };
+        group.push_back(t);
+        pending.clear();
+    }
+
+    ParallelRunner(const ParallelRunner &);
+    ParallelRunner & operator=(const ParallelRunner &);
+    public:
+        static const long long HEAVY_ITERATIONS = 4096;
+        ParallelRunner(const Program & program) : at(0), taskStart(0), taskLow(0), taskHigh(0), reach(0) {
+            for (vector<Node*>::const_iterator it = program.children.begin(); it != program.children.end(); ++it) {
+                add(*it);
+            }
+            flushGroup();
+            ordered.insert(ordered.end(), pending.begin(), pending.end());
+            pending.clear();
+            flushOrdered();
+        }
+        ~ParallelRunner() {
+            for (size_t i = 0; i < steps.size(); i++) {
+                delete steps[i].sequential;
+                for (size_t j = 0; j < steps[i].tasks.size(); j++) delete steps[i].tasks[j].code;
+            }
+        }
+        int groups() const {
+            int n = 0;
+            for (size_t i = 0; i < steps.size(); i++) n += !steps[i].sequential;
+            return n;
+        }
+        bf::Status run(bf::Source * input, bf::Sink * output, const bf::Limits & limits) {
+            const size_t TAPE = BytecodeInterpreter::TAPE;
+            vector<char> tape(TAPE + 2 * reach, 0);
+            char * low = &tape[reach];
+            char * high = low + TAPE;
+            char * pointer = low;
+            BytecodeInterpreter vm;
+            for (size_t i = 0; i < steps.size(); i++) {
+                const Step & step = steps[i];
+                if (step.sequential) {
+                    bf::Status status = vm.run(*step.sequential, low, high, pointer, input, output, limits);
+                    if (status != bf::OK) return status;
+                    continue;
+                }
+                bool fits = true;
+                for (size_t j = 0; j < step.tasks.size(); j++) {
+                    fits = fits && pointer + step.tasks[j].low >= low && pointer + step.tasks[j].high < high;
+                }
+                vector<bf::Status> results(step.tasks.size(), bf::OK);
+                if (fits) {
+                    atomic<size_t> next(0);
+                    size_t workers = min(step.tasks.size(), (size_t)max(1u, thread::hardware_concurrency()));
+                    vector<thread> threads;
+                    for (size_t w = 0; w < workers; w++) {
+                        threads.push_back(thread([&]() {
+                            BytecodeInterpreter worker;
+                            for (size_t j; (j = next++) < step.tasks.size(); ) {
+                                char * p = pointer + step.tasks[j].start;
+                                results[j] = worker.run(*step.tasks[j].code, low, high, p, NULL, NULL, limits);
+                            }
+                        }));
+                    }
+                    for (size_t w = 0; w < workers; w++) threads[w].join();
+                } else {
+                    for (size_t j = 0; j < step.tasks.size() && (j == 0 || results[j - 1] == bf::OK); j++) {
+                        char * p = pointer + step.tasks[j].start;
+                        results[j] = vm.run(*step.tasks[j].code, low, high, p, input, output, limits);
+                    }
+                }
+                for (size_t j = 0; j < results.size(); j++) {
+                    if (results[j] != bf::OK) return results[j];
+                }
+                pointer += step.end;
+            }
+            return bf::OK;
+        }
+};
+
+#ifndef BRAINFUCK_LIBRARY
+
+/**
+ * stdin and stdout for the bytecode interpreter, straight through read() and write().
+ */
+class FileSource : public bf::Source {
+    int fd;
+    public:
+        FileSource(int f) : fd(f) {}
+        size_t read(char * buffer, size_t capacity) {
+            ssize_t n;
+            do {
+                n = ::read(fd, buffer, capacity);
+            } while (n < 0 && errno == EINTR);
+            return n > 0 ? n : 0;
+        }
+};
+
+class FileSink : public bf::Sink {
+    protected:
+        int fd;
+    public:
+        FileSink(int f) : fd(f) {}
+        void write(const char * bytes, size_t length) {
+            while (length) {
+                ssize_t n = ::write(fd, bytes, length);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return;
+                bytes += n;
+                length -= n;
+            }
+        }
+};
+
+#ifdef __linux__
+
+/**
+ * --splice: stdout that hands whole pages to a pipe with vmsplice, instead of having write() copy them in.
+ * For generators whose output goes into another program, gigabytes of it.
+ *
+ * vmsplice lends the pipe our pages rather than copying them, so we can't touch a page again until the reader has
+ * taken it. Hence two buffers, each exactly as big as the pipe: once all of one buffer is in the pipe, nothing of the
+ * other can be (there's no room), so the other is ours to fill. Only full buffers go that way; what's left at the end
+ * goes through write().
+ *
+ * That only holds if the reader read()s: read() copies the bytes out, and then the pages are ours again. A reader that
+ * splices them onward (to a file, or into another pipe) takes references to our pages instead, and the pipe having room
+ * says nothing about when it lets them go, so it can see them overwritten with later output. Only use --splice into
+ * programs that read() their input.
+ *
+ * Output sits in the buffer until it fills, so this is no good for a program you're talking to.
+ * Not a pipe, or no vmsplice? Then it's plain writes, same as FileSink.
+ */
+class PipeSink : public FileSink {
+    char * buffers[2];
+    size_t size;   // of each buffer, and of the pipe
+    int current;   // the buffer we're filling
+    size_t filled;
+    static const int WANT = 1 << 18;
+    PipeSink(const PipeSink &);
+    PipeSink & operator=(const PipeSink &);
+    void lend() {
+        iovec v = { buffers[current], size };
+        while (v.iov_len) {
+            ssize_t n = vmsplice(fd, &v, 1, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                // Gave up partway: write() copies, so the rest (and everything after) is safe that way.
+                FileSink::write((const char *)v.iov_base, v.iov_len);
+                size = 0;
+                break;
+            }
+            v.iov_base = (char *)v.iov_base + n;
+            v.iov_len -= n;
+        }
+        current ^= 1;
+        filled = 0;
+    }
+    public:
+        PipeSink(int f) : FileSink(f), size(0), current(0), filled(0) {
+            buffers[0] = buffers[1] = NULL;
+            struct stat st;
+            if (fstat(fd, &st) || !S_ISFIFO(st.st_mode)) return;
+            int pipe = fcntl(fd, F_SETPIPE_SZ, WANT);
+            if (pipe < 0) pipe = fcntl(fd, F_GETPIPE_SZ);
+            if (pipe <= 0 || pipe % sysconf(_SC_PAGESIZE)) return;
+            size = pipe;
+            for (int i = 0; i < 2; i++) buffers[i] = (char *)aligned_alloc(sysconf(_SC_PAGESIZE), size);
+        }
+        ~PipeSink() {
+            // The pipe may still be holding these pages; we're about to exit, so let them go with the process.
+            finish();
+        }
+        void write(const char * bytes, size_t length) {
+            if (!size) {
+                FileSink::write(bytes, length);
+                return;
+            }
+            while (length) {
+                size_t n = min(length, size - filled);
+                memcpy(buffers[current] + filled, bytes, n);
+                filled += n;
+                bytes += n;
+                length -= n;
+                if (filled == size) lend();
+                if (!size) {
+                    FileSink::write(bytes, length);
+                    return;
+                }
+            }
+        }
+        /**
+         * Writes out what's waiting in the part-filled buffer.
+         */
+        void finish() {
+            if (!size || !filled) return;
+            FileSink::write(buffers[current], filled);
+            filled = 0;
+        }
+};
+
+#endif
+
+/**
+ * --publish-stats: keeps a bf::Stats in shared memory up to date, for bfstat to watch. See brainfuck.h for how
+ * readers get a consistent copy without ever holding us up.
+ */
+class StatsSegment {
+    bf::Stats * stats;
+    string name;
+    StatsSegment(const StatsSegment &);
+    StatsSegment & operator=(const StatsSegment &);
+    public:
+        static const unsigned long long SLICE = 1 << 22; // loop back-edges between updates, while running
+        StatsSegment() : stats(NULL), name("/brainfuck." + to_string(getpid())) {}
+        ~StatsSegment() {
+            if (!stats) return;
+            phase(bf::Stats::DONE);
+            munmap(stats, sizeof(bf::Stats));
+            shm_unlink(name.c_str());
+        }
+        bool open() {
+            int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+            if (fd < 0) return false;
+            void * mapped = MAP_FAILED;
+            if (!ftruncate(fd, sizeof(bf::Stats))) {
+                mapped = mmap(NULL, sizeof(bf::Stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            close(fd);
+            if (mapped == MAP_FAILED) {
+                shm_unlink(name.c_str());
+                return false;
+            }
+            stats = (bf::Stats *)mapped; // comes zeroed, so sequence is even and everything else is 0
+            stats->magic = bf::Stats::MAGIC;
+            return true;
+        }
+        void phase(bf::Stats::Phase now) {
+            update(now, stats->files, stats->iterations, stats->input, stats->output, stats->compiled);
+        }
+        void update(bf::Stats::Phase now, unsigned long long files, unsigned long long iterations,
+                    unsigned long long input, unsigned long long output, unsigned long long compiled) {
+            if (!stats) return;
+            stats->sequence = stats->sequence + 1;
+            atomic_thread_fence(memory_order_release);
+            stats->phase = now;
+            stats->files = files;
+            stats->iterations = iterations;
+            stats->input = input;
+            stats->output = output;
+            stats->compiled = compiled;
+            atomic_thread_fence(memory_order_release);
+            stats->sequence = stats->sequence + 1;
+        }
+};
+
+/**
+ * A Source and a Sink that count the bytes going through, for --publish-stats.
+ */
+class CountingSource : public bf::Source {
+    bf::Source * inner;
+    public:
+        unsigned long long bytes;
+        CountingSource(bf::Source * i) : inner(i), bytes(0) {}
+        size_t read(char * buffer, size_t capacity) {
+            size_t n = inner->read(buffer, capacity);
+            bytes += n;
+            return n;
+        }
+};
+
+class CountingSink : public bf::Sink {
+    bf::Sink * inner;
+    public:
+        unsigned long long bytes;
+        CountingSink(bf::Sink * i) : inner(i), bytes(0) {}
+        void write(const char * buffer, size_t length) {
+            inner->write(buffer, length);
+            bytes += length;
+        }
+};
+
+/**
+ * --tape-in and --tape-out: a tape that starts out as a file's bytes, and ends up as one.
+ *
+ * The tape is one anonymous mapping, padded either side as the bytecode needs; --tape-in maps the file MAP_PRIVATE
+ * over the start of it, so pages come in as the program touches them and the file itself never changes.
+ * The usual 30000 zeroed cells come after the file's bytes, so there's room to work and a zero to find at the end.
+ * --tape-out writes the tape out through a MAP_SHARED mapping of the output file: the file's bytes, and the cells
+ * past them up to the last one that isn't zero, so a tape handed from run to run only grows if the program grows it.
+ */
+class MappedTape {
+    char * base;
+    size_t bytes;
+    size_t given; // bytes that came from the file
+    MappedTape(const MappedTape &);
+    MappedTape & operator=(const MappedTape &);
+    public:
+        char * low;
+        char * high;
+        MappedTape() : base(NULL), bytes(0), given(0), low(NULL), high(NULL) {}
+        ~MappedTape() {
+            if (base) munmap(base, bytes);
+        }
+        /**
+         * name may be NULL, for a zeroed tape. False (and errno) if the file couldn't be mapped.
+         */
+        bool map(const char * name, int reach) {
+            size_t page = sysconf(_SC_PAGESIZE);
+            size_t fileBytes = 0;
+            int fd = -1;
+            if (name) {
+                struct stat st;
+                fd = open(name, O_RDONLY | O_CLOEXEC);
+                if (fd < 0) return false;
+                if (fstat(fd, &st)) {
+                    close(fd);
+                    return false;
+                }
+                fileBytes = st.st_size;
+            }
+            size_t length = fileBytes + BytecodeInterpreter::TAPE;
+            size_t pad = (reach + page - 1) / page * page;
+            bytes = pad + (length + page - 1) / page * page + pad;
+            void * m = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (m == MAP_FAILED) {
+                if (fd >= 0) close(fd);
+                return false;
+            }
+            base = (char *)m;
+            low = base + pad;
+            high = low + length;
+            given = fileBytes;
+            if (fileBytes && mmap(low, fileBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                close(fd);
+                return false;
+            }
+            if (fd >= 0) close(fd);
+            return true;
+        }
+        /**
+         * Into a new file that then takes the name: if it's the --tape-in file, the tape is still that file's pages,
+         * and truncating it in place would zero them before we'd copied them out. False (and errno) if it failed.
+         */
+        bool save(const char * name) const {
+            size_t length = high - low;
+            while (length > given && !low[length - 1]) length--;
+            string temp = string(name) + "." + to_string(getpid());
+            int fd = open(temp.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+            if (fd < 0) return false;
+            bool ok = !ftruncate(fd, length);
+            if (ok && length) {
+                void * m = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                ok = m != MAP_FAILED;
+                if (ok) {
+                    memcpy(m, low, length);
+                    ok = munmap(m, length) == 0;
+                }
+            }
+            close(fd);
+            if (ok && !rename(temp.c_str(), name)) return true;
+            int error = errno;
+            unlink(temp.c_str());
+            errno = error;
+            return false;
+        }
+};
+
+/**
+ * The plain way to read a source file. A file we can't read comes back empty, as it always has.
+ */
+string readFile(const char * name) {
+    string text;
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return text;
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR)) {
+        if (n > 0) text.append(buffer, n);
+    }
+    close(fd);
+    return text;
+}
+
+#ifdef HAVE_IO_URING
+
+/**
+ * Just enough io_uring to read a lot of small files, through the raw syscalls (liburing isn't something we can count on).
+ * It's used in rounds: prepare() up to capacity() operations, then submit() hands them all over in one syscall and
+ * waits for every one of them, calling done(data, result) as each completes.
+ */
+class Ring {
+    int fd;
+    unsigned entries, queued;
+    unsigned * sqTail, * sqMask, * sqArray;
+    unsigned * cqHead, * cqTail, * cqMask;
+    io_uring_sqe * sqes;
+    io_uring_cqe * cqes;
+    void * sq, * cq;
+    size_t sqBytes, cqBytes, sqesBytes;
+    Ring(const Ring &);
+    Ring & operator=(const Ring &);
+    public:
+        Ring(unsigned size) : fd(-1), entries(0), queued(0), sqes(NULL), sq(MAP_FAILED), cq(MAP_FAILED) {
+            io_uring_params p;
+            memset(&p, 0, sizeof(p));
+            int ring = syscall(__NR_io_uring_setup, size, &p);
+            if (ring < 0) return; // too old a kernel, or not allowed: the caller reads files the plain way
+            sqBytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            cqBytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+            if (single) sqBytes = cqBytes = max(sqBytes, cqBytes);
+            sqesBytes = p.sq_entries * sizeof(io_uring_sqe);
+            sq = mmap(NULL, sqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+            cq = single ? sq : mmap(NULL, cqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+            void * e = mmap(NULL, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+            if (sq == MAP_FAILED || cq == MAP_FAILED || e == MAP_FAILED) {
+                if (e != MAP_FAILED) munmap(e, sqesBytes);
+                if (cq != MAP_FAILED && cq != sq) munmap(cq, cqBytes);
+                if (sq != MAP_FAILED) munmap(sq, sqBytes);
+                sq = cq = MAP_FAILED;
+                close(ring);
+                return;
+            }
+            fd = ring;
+            entries = p.sq_entries;
+            sqes = (io_uring_sqe *)e;
+            sqTail = (unsigned *)((char *)sq + p.sq_off.tail);
+            sqMask = (unsigned *)((char *)sq + p.sq_off.ring_mask);
+            sqArray = (unsigned *)((char *)sq + p.sq_off.array);
+            cqHead = (unsigned *)((char *)cq + p.cq_off.head);
+            cqTail = (unsigned *)((char *)cq + p.cq_off.tail);
+            cqMask = (unsigned *)((char *)cq + p.cq_off.ring_mask);
+            cqes = (io_uring_cqe *)((char *)cq + p.cq_off.cqes);
+        }
+        ~Ring() {
+            if (fd < 0) return;
+            munmap(sqes, sqesBytes);
+            if (cq != sq) munmap(cq, cqBytes);
+            munmap(sq, sqBytes);
+            close(fd);
+        }
+        bool ok() const {
+            return fd >= 0;
+        }
+        unsigned capacity() const {
+            return entries;
+        }
+        /**
+         * Registers one buffer, for READ_FIXED to read into without the kernel pinning its pages every time.
+         */
+        bool registerBuffer(void * buffer, size_t length) {
+            iovec v = { buffer, length };
+            return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, &v, 1) == 0;
+        }
+        void unregisterBuffers() {
+            syscall(__NR_io_uring_register, fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        }
+        io_uring_sqe * prepare(unsigned char opcode, int file, unsigned long long data) {
+            unsigned index = (*sqTail + queued++) & *sqMask;
+            io_uring_sqe * e = &sqes[index];
+            memset(e, 0, sizeof(*e));
+            e->opcode = opcode;
+            e->fd = file;
+            e->user_data = data;
+            sqArray[index] = index;
+            return e;
+        }
+        template <class Done> bool submit(Done done) {
+            unsigned n = queued;
+            unsigned pending = n;
+            queued = 0;
+            __atomic_store_n(sqTail, *sqTail + n, __ATOMIC_RELEASE);
+            for (unsigned seen = 0; seen < n; ) {
+                int r = syscall(__NR_io_uring_enter, fd, pending, n - seen, IORING_ENTER_GETEVENTS, NULL, 0);
+                if (r < 0 && errno != EINTR) return false;
+                if (r > 0) pending -= r;
+                unsigned head = *cqHead;
+                unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+                for (; head != tail; head++, seen++) {
+                    const io_uring_cqe & c = cqes[head & *cqMask];
+                    done(c.user_data, c.res);
+                }
+                __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            }
+            return true;
+        }
+};
+
+/**
+ * Reads a round of files in three submissions: open and statx them all, read them all into one registered buffer,
+ * close them all. Anything this can't do in one go (not a regular file, a short read, no buffer registration)
+ * is left empty in ok, for the caller to read the plain way.
+ */
+bool readRound(Ring & ring, const char * const * names, size_t count, string * sources, vector<bool> & ok) {
+    vector<int> fds(count, -1);
+    vector<struct statx> stats(count);
+    vector<bool> statted(count, false);
+    for (size_t i = 0; i < count; i++) {
+        io_uring_sqe * open = ring.prepare(IORING_OP_OPENAT, AT_FDCWD, 2 * i);
+        open->addr = (uintptr_t)names[i];
+        open->open_flags = O_RDONLY | O_CLOEXEC;
+        io_uring_sqe * stat = ring.prepare(IORING_OP_STATX, AT_FDCWD, 2 * i + 1);
+        stat->addr = (uintptr_t)names[i];
+        stat->len = STATX_TYPE | STATX_SIZE;
+        stat->off = (uintptr_t)&stats[i];
+    }
+    bool submitted = ring.submit([&](unsigned long long data, int result) {
+        if (data % 2) {
+            statted[data / 2] = result == 0;
+        } else {
+            fds[data / 2] = result;
+        }
+    });
+    if (!submitted) {
+        for (size_t i = 0; i < count; i++) if (fds[i] >= 0) close(fds[i]);
+        return false;
+    }
+    vector<size_t> at(count, 0);
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (fds[i] < 0 || !statted[i] || !S_ISREG(stats[i].stx_mode)) continue;
+        at[i] = total;
+        total += stats[i].stx_size;
+    }
+    vector<char> buffer(max(total, (size_t)1));
+    bool fixed = ring.registerBuffer(buffer.data(), buffer.size());
+    vector<int> got(count, -1);
+    size_t reads = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (fds[i] < 0 || !statted[i] || !S_ISREG(stats[i].stx_mode) || !stats[i].stx_size) continue;
+        io_uring_sqe * read = ring.prepare(fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, fds[i], i);
+        read->addr = (uintptr_t)(buffer.data() + at[i]);
+        read->len = stats[i].stx_size;
+        reads++;
+    }
+    if (reads) {
+        submitted = ring.submit([&](unsigned long long data, int result) { got[data] = result; });
+    }
+    if (fixed) ring.unregisterBuffers();
+    for (size_t i = 0; i < count; i++) {
+        if (fds[i] >= 0) ring.prepare(IORING_OP_CLOSE, fds[i], i);
+    }
+    if (!ring.submit([](unsigned long long, int) {})) {
+        for (size_t i = 0; i < count; i++) if (fds[i] >= 0) close(fds[i]);
+    }
+    for (size_t i = 0; submitted && i < count; i++) {
+        if (fds[i] < 0 || !statted[i] || !S_ISREG(stats[i].stx_mode)) continue;
+        if (got[i] == (int)stats[i].stx_size || !stats[i].stx_size) {
+            sources[i].assign(buffer.data() + at[i], stats[i].stx_size);
+            ok[i] = true;
+        }
+    }
+    return submitted;
+}
+
+#endif
+
+/**
+ * A source file mapped in rather than read, for --direct. Anything that won't map (a pipe, say) is read instead.
+ */
+class MappedSource {
+    void * mapped;
+    string copy;
+    MappedSource(const MappedSource &);
+    MappedSource & operator=(const MappedSource &);
+    public:
+        const char * text;
+        size_t length;
+        MappedSource(const char * name) : mapped(MAP_FAILED), text(NULL), length(0) {
+            int fd = open(name, O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (fd >= 0 && !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+                mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+            if (mapped != MAP_FAILED) {
+                text = (const char *)mapped;
+                length = st.st_size;
+            } else {
+                copy = readFile(name);
+                text = copy.data();
+                length = copy.size();
+            }
+            if (fd >= 0) close(fd);
+        }
+        ~MappedSource() {
+            if (mapped != MAP_FAILED) munmap(mapped, length);
+        }
+};
+
+/**
+ * Reads every file named on the command line up front. With io_uring that's three syscalls per round of files
+ * instead of an open, a few reads and a close each; runs of lots of tiny programs spend most of their time on those.
+ * Whatever the ring doesn't read (all of it, without io_uring or with only one file) goes through readFile's own
+ * open() and read()s.
+ */
+vector<string> readAll(const vector<const char *> & names) {
+    vector<string> sources(names.size());
+    vector<bool> ok(names.size(), false);
+#ifdef HAVE_IO_URING
+    static const size_t ROUND = 128; // files per round: an open and a statx each
+    if (names.size() >= 2) {
+        Ring ring(2 * ROUND);
+        for (size_t i = 0; ring.ok() && i < names.size(); i += ROUND) {
+            size_t count = min(ROUND, names.size() - i);
+            vector<bool> round(count, false);
+            if (!readRound(ring, &names[i], count, &sources[i], round)) break;
+            copy(round.begin(), round.end(), ok.begin() + i);
+        }
+    }
+#endif
+    for (size_t i = 0; i < names.size(); i++) {
+        if (!ok[i]) sources[i] = readFile(names[i]);
+    }
+    return sources;
+}
+
+const char * describe(bf::Status status) {
+    switch (status) {
+        case bf::OK:            return "ok";
+        case bf::OUT_OF_FUEL:   return "ran out of fuel";
+        case bf::OUT_OF_OUTPUT: return "wrote too much output";
+        case bf::OUT_OF_TAPE:   return "ran off the end of the tape";
+        case bf::NEVER_ENDS:    return "entered a loop that never ends";
+    }
+    return "?";
+}
+
+/**
+ * --repl: type Brainfuck a line at a time, run it on a tape that stays put between lines.
+ *
+ * A line with a '[' still open waits for more lines until it's closed. Each entry is parsed once and kept,
+ * and its bytecode is kept too, so typing the same thing again costs a lookup. What we compile does depend on the tape:
+ * we run the entry's straight-line start on paper against the real tape, and any top-level loop whose cell is zero
+ * when it'd be reached gets left out (it couldn't run). Which loops got left out is part of the cache key.
+ *
+ * Prompts and errors go to stderr (prompts only if stdin is a terminal), so stdout is just what the program wrote.
+ * ',' reads the lines typed after the entry, a byte at a time, so it only takes what it needs.
+ */
+class Repl {
+    /**
+     * stdin, shared: the REPL takes whole lines, the running program takes single bytes.
+     */
+    class Input : public bf::Source {
+        FileSource file;
+        char buffer[4096];
+        size_t at, filled;
+        public:
+            Input() : file(0), at(0), filled(0) {}
+            bool next(char & c) {
+                if (at == filled) {
+                    at = 0;
+                    filled = file.read(buffer, sizeof(buffer));
+                    if (!filled) return false;
+                }
+                c = buffer[at++];
+                return true;
+            }
+            bool line(string & text) {
+                text.clear();
+                char c;
+                while (next(c)) {
+                    text += c;
+                    if (c == '\n') return true;
+                }
+                return !text.empty();
+            }
+            size_t read(char * bytes, size_t capacity) {
+                return capacity && next(*bytes) ? 1 : 0;
+            }
+    };
+    static const size_t CACHE = 4096;   // entries of each kind before we start over
+    static const int PADDING = 64;      // tape padding to start with; grows if some bytecode reaches further
+    Input in;
+    FileSink out;
+    FileSink err;
+    bool interactive;
+    vector<char> tape;
+    int padding;
+    char * pointer;
+    unordered_map<string, Program *> parsed;
+    unordered_map<string, Bytecode *> compiled;
+    BytecodeInterpreter vm;
+
+    void say(const string & text) {
+        err.write(text.data(), text.size());
+    }
+    char * low() {
+        return &tape[padding];
+    }
+    void pad(int reach) {
+        if (reach <= padding) return;
+        int at = pointer - low();
+        vector<char> bigger(BytecodeInterpreter::TAPE + 2 * reach, 0);
+        copy(low(), low() + BytecodeInterpreter::TAPE, bigger.begin() + reach);
+        tape.swap(bigger);
+        padding = reach;
+        pointer = low() + at;
+    }
+    /**
+     * Which of the top-level nodes are loops that can't run on the tape as it is now.
+     * Straight-line commands are followed exactly, on the side; the first loop that would run, or ',', ends what we know.
+     */
+    vector<bool> dead(const Program * program) {
+        vector<bool> drop(program->children.size(), false);
+        map<int, int> written; // offset -> value, for cells the entry has changed so far
+        int at = 0;
+        for (size_t i = 0; i < program->children.size(); i++) {
+            char * cell = pointer + at;
+            if (cell < low() || cell >= low() + BytecodeInterpreter::TAPE) break;
+            map<int, int>::iterator w = written.find(at);
+            int value = w != written.end() ? w->second : (unsigned char)*cell;
+            if (dynamic_cast<const Loop *>(program->children[i])) {
+                if (value) break;
+                drop[i] = true;
+                continue;
+            }
+            const CommandNode * leaf = static_cast<const CommandNode *>(program->children[i]);
+            switch (leaf->command) {
+                case SHIFT_LEFT:  at -= leaf->count; break;
+                case SHIFT_RIGHT: at += leaf->count; break;
+                case INCREMENT:   written[at] = (value + leaf->count) & 255; break;
+                case DECREMENT:   written[at] = (value - leaf->count) & 255; break;
+                case ZERO:        written[at] = 0; break;
+                case TRAP:        if (value) return drop; break;
+                case OUTPUT:      break;
+                case INPUT:       return drop;
+            }
+        }
+        return drop;
+    }
+    Bytecode * compile(const string & source) {
+        Program *& program = parsed[source];
+        if (!program) {
+            program = new Program();
+            const char * cursor = source.data();
+            parse(cursor, cursor + source.size(), program);
+            LoopNumberer numberer;
+            program->accept(&numberer);
+        }
+        vector<bool> drop = dead(program);
+        string key = source + '\0';
+        for (size_t i = 0; i < drop.size(); i++) key += drop[i] ? '1' : '0';
+        Bytecode *& bytecode = compiled[key];
+        if (!bytecode) {
+            Program fragment;
+            for (size_t i = 0; i < drop.size(); i++) {
+                if (!drop[i]) fragment.children.push_back(program->children[i]);
+            }
+            bytecode = lower(fragment, false);
+            fragment.children.clear(); // still owned by program
+        }
+        return bytecode;
+    }
+    void forget() {
+        for (unordered_map<string, Bytecode *>::iterator it = compiled.begin(); it != compiled.end(); ++it) delete it->second;
+        for (unordered_map<string, Program *>::iterator it = parsed.begin(); it != parsed.end(); ++it) delete it->second;
+        compiled.clear();
+        parsed.clear();
+    }
+    /**
+     * How deep the brackets are still open, or -1 if a ']' closed something that wasn't open.
+     */
+    static int depth(const string & source) {
+        int open = 0;
+        for (size_t i = 0; i < source.size(); i++) {
+            if (source[i] == '[') open++;
+            if (source[i] == ']' && --open < 0) return -1;
+        }
+        return open;
+    }
+    Repl(const Repl &);
+    Repl & operator=(const Repl &);
+    public:
+        Repl() : out(1), err(2), interactive(isatty(0)), tape(BytecodeInterpreter::TAPE + 2 * PADDING, 0), padding(PADDING) {
+            pointer = low();
+        }
+        ~Repl() {
+            forget();
+        }
+        void run(const bf::Limits & limits) {
+            string entry, line;
+            while (true) {
+                if (interactive) say(entry.empty() ? "bf> " : "... ");
+                if (!in.line(line)) break;
+                entry += line;
+                int open = depth(entry);
+                if (open > 0) continue;
+                if (open < 0) {
+                    say("unmatched ]\n");
+                    entry.clear();
+                    continue;
+                }
+                if (parsed.size() >= CACHE || compiled.size() >= CACHE) forget();
+                Bytecode * bytecode = compile(entry);
+                entry.clear();
+                pad(bytecode->reach);
+                char * before = pointer;
+                bf::Status status = vm.run(*bytecode, low(), low() + BytecodeInterpreter::TAPE, pointer, &in, &out, limits);
+                if (status == bf::OUT_OF_TAPE) pointer = before;
+                if (status != bf::OK) say(string(describe(status)) + "\n");
+            }
+            if (interactive) say("\n");
+        }
+};
+
+/**
+ * --watch: parses a source that keeps changing, a top-level piece at a time.
+ *
+ * One pass over the brackets cuts the source into chunks: each top-level loop, and each straight stretch between them.
+ * Chunks are kept in a table keyed by their text, so an unchanged chunk (same hash, same bytes) gets its old nodes back
+ * and only the chunks an edit touched are parsed again. Reused loops are the very same Loop objects as last time,
+ * so the Analysis kept here already has their facts, and the expensive part of lowering is skipped for them too.
+ *
+ * The Program that update() fills in only borrows the nodes: release() it before it goes away.
+ * Chunks a version doesn't use are deleted on the next update(), after the lowering that dropped them is done with.
+ */
+class IncrementalParser {
+    struct Chunk {
+        vector<Node*> nodes;
+        unsigned version; // the last version that used it
+    };
+    unordered_map<string, Chunk> chunks;
+    unsigned version;
+    IncrementalParser(const IncrementalParser &);
+    IncrementalParser & operator=(const IncrementalParser &);
+    void drop(Chunk & chunk) {
+        for (size_t i = 0; i < chunk.nodes.size(); i++) delete chunk.nodes[i];
+    }
+    public:
+        Analysis analysis;
+        size_t parsed; // chunks the last update() had to parse
+        size_t total;  // ...out of this many
+        IncrementalParser() : version(0), parsed(0), total(0) {}
+        ~IncrementalParser() {
+            for (unordered_map<string, Chunk>::iterator it = chunks.begin(); it != chunks.end(); ++it) drop(it->second);
+        }
+        void update(const string & source, Program & program) {
+            for (unordered_map<string, Chunk>::iterator it = chunks.begin(); it != chunks.end(); ) {
+                if (it->second.version == version) {
+                    ++it;
+                    continue;
+                }
+                drop(it->second);
+                it = chunks.erase(it);
+            }
+            version++;
+            parsed = total = 0;
+            size_t start = 0;
+            int depth = 0;
+            size_t end = source.size();
+            for (size_t i = 0; i < end; i++) {
+                if (source[i] == '[') {
+                    if (!depth && i > start) add(source, start, i, program);
+                    if (!depth) start = i;
+                    depth++;
+                } else if (source[i] == ']') {
+                    if (!depth) {
+                        end = i; // parse() stops at a stray ']'
+                        break;
+                    }
+                    if (!--depth) {
+                        add(source, start, i + 1, program);
+                        start = i + 1;
+                    }
+                }
+            }
+            if (start < end) add(source, start, end, program);
+        }
+        void release(Program & program) {
+            program.children.clear();
+        }
+    private:
+        void add(const string & source, size_t start, size_t end, Program & program) {
+            total++;
+            string text = source.substr(start, end - start);
+            unordered_map<string, Chunk>::iterator it = chunks.find(text);
+            if (it == chunks.end()) {
+                parsed++;
+                Program piece;
+                const char * cursor = text.data();
+                parse(cursor, cursor + text.size(), &piece);
+                Chunk chunk = { piece.children, version };
+                piece.children.clear();
+                it = chunks.insert(make_pair(text, chunk)).first;
+            }
+            it->second.version = version;
+            program.children.insert(program.children.end(), it->second.nodes.begin(), it->second.nodes.end());
+        }
+};
+
+/**
+ * Reruns a file every time it changes, reusing what it can from the last time round (see IncrementalParser).
+ * Each run gets no input; what it took to get ready goes to stderr.
+ */
+void watch(const char * name, const bf::Limits & limits) {
+    IncrementalParser incremental;
+    BytecodeInterpreter vm;
+    FileSink out(1);
+    FileSink err(2);
+    struct stat last;
+    memset(&last, 0, sizeof(last));
+    while (true) {
+        struct stat now;
+        if (stat(name, &now) || (now.st_size == last.st_size && now.st_mtim.tv_sec == last.st_mtim.tv_sec
+                                 && now.st_mtim.tv_nsec == last.st_mtim.tv_nsec && now.st_ino == last.st_ino)) {
+            usleep(100000);
+            continue;
+        }
+        last = now;
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        string source = readFile(name);
+        Program program;
+        incremental.update(source, program);
+        LoopNumberer numberer;
+        program.accept(&numberer);
+        Bytecode * bytecode = lower(program, true, &incremental.analysis);
+        incremental.release(program);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        long micros = (t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_nsec - t0.tv_nsec) / 1000;
+        string note = string("[") + name + ": parsed " + to_string(incremental.parsed) + " of "
+            + to_string(incremental.total) + " chunks, ready in " + to_string(micros) + "us]\n";
+        err.write(note.data(), note.size());
+        bf::Status status = vm.run(*bytecode, "", 0, &out, limits);
+        delete bytecode;
+        if (status != bf::OK) {
+            string complaint = string("[") + name + ": " + describe(status) + "]\n";
+            err.write(complaint.data(), complaint.size());
+        }
+    }
+}
+
+#ifdef BRAINFUCK_FAST_START
+
+/**
+ * Says what went wrong on stderr, without stdio or iostream. file may be NULL.
+ */
+void complain(const char * program, const char * file, const char * what) {
+    string line = string(program) + ": ";
+    if (file) line += string(file) + ": ";
+    line += string(what) + "\n";
+    FileSink(2).write(line.data(), line.size());
+}
+
+/**
+ * The fast-start build (see the top of the file): each file on the bytecode engine, or the source interpreter with --direct.
+ * No iostream, so no static initializers, locales or stdio syncing before we get here; I/O is read() and write().
+ */
+int main(int argc, char *argv[]) {
+    bool direct = false;
+    vector<const char *> files;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--direct")) {
+            direct = true;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty()) {
+        complain(argv[0], NULL, "No input files.");
+        return 1;
+    }
+    FileSource in(0);
+    FileSink out(1);
+    bf::Limits unlimited = { 0, 0 };
+    for (size_t i = 0; i < files.size(); i++) {
+        MappedSource source(files[i]);
+        bf::Status status;
+        if (direct) {
+            DirectInterpreter interpreter;
+            status = interpreter.run(source.text, source.length, &in, &out);
+        } else {
+            Program program;
+            LoopNumberer numberer;
+            const char * cursor = source.text;
+            parse(cursor, cursor + source.length, &program);
+            program.accept(&numberer);
+            Bytecode * bytecode = lower(program);
+            BytecodeInterpreter vm;
+            status = vm.run(*bytecode, &in, &out, unlimited);
+            delete bytecode;
+        }
+        if (status != bf::OK) {
+            complain(argv[0], files[i], describe(status));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#else
+
+/**
+ * --samples-out FILE: a sampling profile, cheap enough to leave on. A profiling timer (SIGPROF, every millisecond
+ * of CPU time) looks at which instruction the BytecodeInterpreter is on, and counts it. At the end the counts go out
+ * in folded form, one line per stack, ready for flamegraph.pl:
+ *
+ *     99botles.bf;[3:1;[5:12;MUL 42
+ *
+ * The frames are the file, the loops around the instruction from the outside in (each one is where its '[' is,
+ * as line:column), and last the instruction's opcode. Only the plain bytecode engine is sampled.
+ */
+class SamplingProfiler : public Visitor {
+    static SamplingProfiler * active;
+    Sampler sampler;
+    const Instruction * code;
+    vector<unsigned long> counts; // per instruction, only touched by tick() while the timer's on
+    vector<int> parents;          // per loop id
+    vector<const char *> brackets;
+    vector<int> nest;
+    struct sigaction previous;
+    static void tick(int) {
+        SamplingProfiler * p = active;
+        const Instruction * at = p ? p->sampler.at : NULL;
+        if (at) p->counts[at - p->code]++;
+    }
+    static void timer(long micros) {
+        struct itimerval every;
+        every.it_interval.tv_sec = every.it_value.tv_sec = 0;
+        every.it_interval.tv_usec = every.it_value.tv_usec = micros;
+        setitimer(ITIMER_PROF, &every, NULL);
+    }
+    public:
+        SamplingProfiler() : code(NULL) {}
+        void start(const Bytecode & bytecode, BytecodeInterpreter & vm) {
+            code = bytecode.code;
+            counts.assign(bytecode.size, 0);
+            vm.sampler = &sampler;
+            active = this;
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = tick;
+            action.sa_flags = SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            sigaction(SIGPROF, &action, &previous);
+            timer(1000);
+        }
+        void stop(BytecodeInterpreter & vm) {
+            timer(0);
+            sigaction(SIGPROF, &previous, NULL);
+            active = NULL;
+            vm.sampler = NULL;
+        }
+        /**
+         * Writes out what the last run collected. The program has to be the one that was lowered, and source its text.
+         */
+        void report(Program & program, const string & source, const char * name, ostream & out) {
+            parents.clear();
+            brackets.clear();
+            nest.clear();
+            program.accept(this);
+            vector<int> lines(1, 0);
+            for (size_t i = 0; i < source.size(); i++) {
+                if (source[i] == '\n') lines.push_back(i + 1);
+            }
+            map<string, unsigned long> stacks;
+            for (size_t i = 0; i < counts.size(); i++) {
+                if (!counts[i]) continue;
+                string stack = opcodeNames[code[i].op];
+                for (int loop = code[i].loop; loop >= 0 && loop < (int)parents.size(); loop = parents[loop]) {
+                    string frame = "[?";
+                    const char * at = brackets[loop];
+                    if (at >= source.data() && at < source.data() + source.size()) {
+                        int offset = at - source.data();
+                        int line = upper_bound(lines.begin(), lines.end(), offset) - lines.begin();
+                        frame = "[" + to_string(line) + ":" + to_string(offset - lines[line - 1] + 1);
+                    }
+                    stack = frame + ";" + stack;
+                }
+                stacks[string(name) + ";" + stack] += counts[i];
+            }
+            for (map<string, unsigned long>::const_iterator it = stacks.begin(); it != stacks.end(); ++it) {
+                out << it->first << ' ' << it->second << '\n';
+            }
+        }
+        void visit(const CommandNode *) {}
+        void visit(const Loop * loop) {
+            if (loop->id >= (int)parents.size()) {
+                parents.resize(loop->id + 1, -1);
+                brackets.resize(loop->id + 1, NULL);
+            }
+            parents[loop->id] = nest.empty() ? -1 : nest.back();
+            brackets[loop->id] = loop->at;
+            nest.push_back(loop->id);
+            for (vector<Node*>::const_iterator it = loop->children.begin(); it != loop->children.end(); ++it) {
+                (*it)->accept(this);
+            }
+            nest.pop_back();
+        }
+        void visit(const Program * program) {
+            for (vector<Node*>::const_iterator it = program->children.begin(); it != program->children.end(); ++it) {
+                (*it)->accept(this);
+            }
+        }
+};
+
+SamplingProfiler * SamplingProfiler::active = NULL;
+
+/**
+ * --latency: a Latencies for the run, reported on stderr when the file is done, and on SIGUSR1 at the next read or write.
+ */
+Latencies * latencyReport = NULL;
+
+void reportLatencies(int) {
+    if (latencyReport) latencyReport->wanted = 1;
+}
+
+int main(int argc, char *argv[]) {
+    Printer printer;
+	JavaCompiler compiler;
+    Interpreter interpreter;
+    BytecodeInterpreter vm;
+    Profile profile;
+    bool tree = false;
+    bool stats = false;
+    bool parallel = false;
+    bool direct = false;
+    bool repl = false;
+    bool watching = false;
+    bool rle = false;
+    bool printing = false;
+    bool minify = false;
+    bool latency = false;
+    bool publishing = false;
+#ifdef __linux__
+    PipeSink * piped = NULL;
+#endif
+    const char * profileIn = NULL;
+    const char * profileOut = NULL;
+    const char * tapeIn = NULL;
+    const char * tapeOut = NULL;
+    const char * samplesOut = NULL;
+    bf::Limits limits = { 0, 0 };
+    vector<const char *> files;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--profile-out") && i + 1 < argc) {
+            profileOut = argv[++i];
+        } else if (!strcmp(argv[i], "--profile-in") && i + 1 < argc) {
+            profileIn = argv[++i];
+        } else if (!strcmp(argv[i], "--fuel") && i + 1 < argc) {
+            limits.fuel = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--tape-in") && i + 1 < argc) {
+            tapeIn = argv[++i];
+        } else if (!strcmp(argv[i], "--tape-out") && i + 1 < argc) {
+            tapeOut = argv[++i];
+        } else if (!strcmp(argv[i], "--samples-out") && i + 1 < argc) {
+            samplesOut = argv[++i];
+        } else if (!strcmp(argv[i], "--tree")) {
+            tree = true;
+        } else if (!strcmp(argv[i], "--opcode-stats")) {
+            stats = true;
+        } else if (!strcmp(argv[i], "--parallel")) {
+            parallel = true;
+        } else if (!strcmp(argv[i], "--direct")) {
+            direct = true;
+        } else if (!strcmp(argv[i], "--repl")) {
+            repl = true;
+        } else if (!strcmp(argv[i], "--watch")) {
+            watching = true;
+        } else if (!strcmp(argv[i], "--rle")) {
+            rle = true;
+        } else if (!strcmp(argv[i], "--print-rle")) {
+            printing = true;
+        } else if (!strcmp(argv[i], "--minify")) {
+            minify = true;
+        } else if (!strcmp(argv[i], "--latency")) {
+            latency = true;
+        } else if (!strcmp(argv[i], "--publish-stats")) {
+            publishing = true;
+#ifdef __linux__
+        } else if (!strcmp(argv[i], "--splice")) {
+            if (!piped) piped = new PipeSink(1); // never deleted: the pipe may hold its pages until we exit
+#endif
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    // These work on the bytecode interpreter's run, so there has to be one.
+    const char * ownOutput = tree ? "--tree" : profileOut ? "--profile-out" : repl ? "--repl" : watching ? "--watch"
+                           : minify ? "--minify" : printing ? "--print-rle" : stats ? "--opcode-stats" : NULL;
+    const char * engine = parallel ? "--parallel" : direct ? "--direct" : ownOutput;
+    const char * bytecodeOnly = tapeIn ? "--tape-in" : tapeOut ? "--tape-out" : samplesOut ? "--samples-out"
+                              : latency ? "--latency" : publishing ? "--publish-stats" : NULL;
+    if (engine && bytecodeOnly) {
+        cerr << argv[0] << ": " << bytecodeOnly << " doesn't work with " << engine << endl;
+        return 1;
+    }
+    const char * unfueled = tree ? "--tree" : direct ? "--direct" : profileOut ? "--profile-out" : NULL;
+    if (limits.fuel && unfueled) {
+        cerr << argv[0] << ": --fuel doesn't work with " << unfueled << endl;
+        return 1;
+    }
+    if (profileOut && files.size() > 1) {
+        cerr << argv[0] << ": --profile-out takes one program at a time" << endl;
+        return 1;
+    }
+    if (samplesOut && (tapeIn || tapeOut)) {
+        cerr << argv[0] << ": --samples-out doesn't work with --tape-in or --tape-out" << endl;
+        return 1;
+    }
+    if (publishing && (tapeIn || tapeOut || samplesOut)) {
+        cerr << argv[0] << ": --publish-stats doesn't work with --tape-in, --tape-out or --samples-out" << endl;
+        return 1;
+    }
+#ifdef __linux__
+    // And these write their output their own way, not through a Sink we could hand over.
+    if (piped && ownOutput) {
+        cerr << argv[0] << ": --splice doesn't work with " << ownOutput << endl;
+        return 1;
+    }
+#endif
+    FileSink errors(2);
+    Latencies latencies(&errors);
+    if (latency) {
+        vm.latencies = latencyReport = &latencies;
+        signal(SIGUSR1, reportLatencies);
+    }
+    StatsSegment segment;
+    unsigned long long bytesIn = 0, bytesOut = 0;
+    if (publishing && !segment.open()) {
+        cerr << argv[0] << ": couldn't set up shared memory for --publish-stats: " << strerror(errno) << endl;
+        publishing = false;
+    }
+    if (profileIn && !profile.load(profileIn)) {
+        cerr << argv[0] << ": " << profileIn << ": not a usable profile, ignoring it." << endl;
+        profile.loops.clear();
+        profileIn = NULL;
+    }
+    if (repl) {
+        Repl session;
+        session.run(limits);
+    } else if (files.empty()) {
+        cout << argv[0] << ": No input files." << endl;
+    } else if (watching) {
+        watch(files[0], limits);
+    } else if (direct) {
+        DirectInterpreter interpreter;
+        for (size_t i = 0; i < files.size(); i++) {
+            MappedSource source(files[i]);
+            FileSource in(0);
+            FileSink plain(1);
+            bf::Sink * out = &plain;
+#ifdef __linux__
+            if (piped) out = piped;
+#endif
+            bf::Status status = interpreter.run(source.text, source.length, &in, out);
+#ifdef __linux__
+            if (piped) piped->finish();
+#endif
+            if (status != bf::OK) {
+                cerr << argv[0] << ": " << files[i] << ": " << describe(status) << endl;
+                return 1;
+            }
+        }
+    } else {
+        vector<string> sources = readAll(files);
+        for (size_t i = 0; i < files.size(); i++) {
+            Program program;
+            const string & source = sources[i];
+            const char * cursor = source.data();
+            size_t length = strlen(files[i]);
+            bool counted = rle || (length > 4 && !strcmp(files[i] + length - 4, ".bfr"));
+            if (publishing) segment.phase(bf::Stats::PARSING);
+            parse(cursor, cursor + source.size(), & program, counted);
+            if (printing || minify) {
+                Printer compact(printing, minify);
+                program.accept(&compact);
+                continue;
+            }
+            Fingerprint fingerprint;
+            if (profileIn || profileOut) program.accept(&fingerprint);
+            bool profiled = profileIn && profile.program == fingerprint.hash;
+            if (profileIn && !profiled) {
+                cerr << argv[0] << ": " << profileIn << ": profile doesn't match " << files[i] << ", ignoring it." << endl;
+            }
+            LoopNumberer numberer(profiled ? &profile : NULL);
+            program.accept(&numberer);
+            if (profileOut) {
+                // Training run: count everything, then leave the profile for the next compile.
+                profile.reset(fingerprint.hash, numberer.count);
+                interpreter.profile = &profile;
+            }
+         //  program.accept(&printer);
+            if (tree || profileOut) {
+                program.accept(&interpreter);
+            } else {
+                if (stats) {
+                    BytecodeCompiler lowering;
+                    program.accept(&lowering);
+                    opcodeStats(lowering.code, profiled ? &profile : NULL, cout);
+                    if (parallel) cout << ParallelRunner(program).groups() << "\tparallel groups\n";
+                    continue;
+                }
+                FileSource in(0);
+                FileSink plain(1);
+                bf::Sink * out = &plain;
+#ifdef __linux__
+                if (piped) out = piped;
+#endif
+                bf::Status status;
+                if (tapeIn || tapeOut) {
+                    // Runs on the mapped tape, so it's always the plain bytecode engine.
+                    Bytecode * bytecode = lower(program);
+                    MappedTape tape;
+                    if (!tape.map(tapeIn, bytecode->reach)) {
+                        if (tapeIn) {
+                            cerr << argv[0] << ": " << tapeIn << ": " << strerror(errno) << endl;
+                        } else {
+                            cerr << argv[0] << ": couldn't map a tape: " << strerror(errno) << endl;
+                        }
+                        return 1;
+                    }
+                    char * pointer = tape.low;
+                    status = vm.run(*bytecode, tape.low, tape.high, pointer, &in, out, limits);
+                    delete bytecode;
+                    if (tapeOut && !tape.save(tapeOut)) {
+                        cerr << argv[0] << ": " << tapeOut << ": " << strerror(errno) << endl;
+                        return 1;
+                    }
+                } else if (parallel) {
+                    ParallelRunner runner(program);
+                    status = runner.run(&in, out, limits);
+                } else if (publishing) {
+                    // Runs in slices, so the numbers move while it runs.
+                    segment.phase(bf::Stats::LOWERING);
+                    Bytecode * bytecode = lower(program);
+                    CountingSource counted(&in);
+                    CountingSink counting(out);
+                    vm.begin(*bytecode, &counted, &counting, limits);
+                    bool over = false;
+                    while (!over) {
+                        segment.update(bf::Stats::RUNNING, i, vm.iterations, bytesIn + counted.bytes,
+                                       bytesOut + counting.bytes, bytecode->size);
+                        over = vm.slice(StatsSegment::SLICE, status);
+                    }
+                    bytesIn += counted.bytes;
+                    bytesOut += counting.bytes;
+                    segment.update(bf::Stats::RUNNING, i + 1, vm.iterations, bytesIn, bytesOut, 0);
+                    delete bytecode;
+                } else if (samplesOut) {
+                    Bytecode * bytecode = lower(program);
+                    SamplingProfiler sampling;
+                    sampling.start(*bytecode, vm);
+                    status = vm.run(*bytecode, &in, out, limits);
+                    sampling.stop(vm);
+                    ofstream samples(samplesOut, i ? ios::app : ios::trunc);
+                    sampling.report(program, source, files[i], samples);
+                    if (!samples) cerr << argv[0] << ": couldn't write samples to " << samplesOut << endl;
+                    delete bytecode;
+                } else {
+                    Bytecode * bytecode = lower(program);
+                    status = vm.run(*bytecode, &in, out, limits);
+                    delete bytecode;
+                }
+#ifdef __linux__
+                if (piped) piped->finish();
+#endif
+                if (latency) latencies.report();
+                if (status != bf::OK) {
+                    cerr << argv[0] << ": " << files[i] << ": " << describe(status) << endl;
+                    return 1;
+                }
+            }
+		 //	program.accept(&compiler);
+            if (profileOut && !profile.save(profileOut)) {
+                cerr << argv[0] << ": couldn't write profile to " << profileOut << endl;
+            }
+        }
+    }
+}
+
+#endif
+
+#endif
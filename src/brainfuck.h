@@ -0,0 +1,159 @@
+/*
+= Brainfuck, the library
+
+Compile a program once, then run it as many times as you like, in process, instead of spawning brainfuck.exe.
+Nothing here touches iostreams or global state: input comes from a buffer (or a Source), output goes to a Sink.
+
+If you have gcc:
+
+----
+g++ -O2 -pthread -c -DBRAINFUCK_LIBRARY -o brainfuck.o brainfuck.cpp
+g++ -O2 -pthread -o service service.cpp brainfuck.o
+----
+
+----
+#include "brainfuck.h"
+
+class Collect : public bf::Sink {
+    public:
+        std::string text;
+        void write(const char * bytes, size_t length) { text.append(bytes, length); }
+};
+
+bf::Compiled * rot13 = bf::compile(source, length);
+bf::Limits limits = { 1000000, 4096 };
+Collect out;
+if (bf::run(rot13, "Hello", 5, &out, limits) != bf::OK) ...
+bf::release(rot13);
+----
+*/
+
+#ifndef BRAINFUCK_H
+#define BRAINFUCK_H
+
+#include <cstddef>
+
+namespace bf {
+
+typedef enum {
+    OK,
+    OUT_OF_FUEL,   // ran more loop iterations than Limits::fuel
+    OUT_OF_OUTPUT, // tried to write more than Limits::output bytes
+    OUT_OF_TAPE,   // moved the pointer off either end of the tape
+    NEVER_ENDS     // entered a loop that can be shown never to finish, e.g. [] (stopped right away, not left to spin)
+} Status;
+
+/**
+ * How far a run may go before we stop it. Zero means no limit.
+ */
+struct Limits {
+    unsigned long long fuel; // loop iterations (taken back-edges)
+    size_t output;           // bytes written
+};
+
+/**
+ * Where output goes. It arrives in chunks, not a byte at a time.
+ */
+class Sink {
+    public:
+        virtual ~Sink() {}
+        virtual void write(const char * bytes, size_t length) = 0;
+};
+
+/**
+ * Where input comes from, for input that isn't all there up front (a pipe, a socket).
+ * read() fills up to capacity bytes and returns how many it gave; 0 means EOF.
+ * At EOF, ',' leaves the cell alone, same as brainfuck.exe.
+ */
+class Source {
+    public:
+        virtual ~Source() {}
+        virtual size_t read(char * buffer, size_t capacity) = 0;
+};
+
+/**
+ * A compiled program. Opaque; share it between threads freely, it's never modified after compile().
+ */
+struct Compiled;
+
+Compiled * compile(const char * source, size_t length);
+void release(Compiled * program);
+
+Status run(const Compiled * program, const char * input, size_t length, Sink * output, const Limits & limits);
+Status run(const Compiled * program, Source * input, Sink * output, const Limits & limits);
+
+/**
+ * One run in a batch: its input, where its output goes, and (after the batch) how it went.
+ */
+struct Job {
+    const char * input;
+    size_t length;
+    Sink * output;
+    Status status;
+};
+
+/**
+ * Runs the same program over many inputs, reusing one tape.
+ */
+void run(const Compiled * program, Job * jobs, size_t count, const Limits & limits);
+
+/**
+ * One run for a Scheduler. Fill it in, spawn() it, and don't touch it again until finished() is called
+ * (on one of the scheduler's threads) or wait() returns. Its Source and Sink get used from whichever thread
+ * it happens to be running on, one at a time.
+ */
+class Instance {
+    public:
+        const Compiled * program;
+        Source * input;
+        Sink * output;
+        Limits limits;
+        Status status;
+        Instance(const Compiled * p, Source * in, Sink * out, const Limits & l)
+            : program(p), input(in), output(out), limits(l), status(OK) {}
+        virtual ~Instance() {}
+        virtual void finished() {}
+};
+
+/**
+ * Runs lots of Instances on a few threads. Each instance gets the thread for a slice of loop back-edges,
+ * then goes to the back of the queue, so a program that never stops can't keep a short one waiting.
+ * Every thread has its own queue; one that runs dry takes work from the others.
+ *
+ * A Source whose read() blocks holds on to its thread while it waits, so have more threads than those.
+ */
+class Scheduler {
+    public:
+        Scheduler(size_t threads, unsigned long long slice = 100000);
+        ~Scheduler(); // waits for everything spawned, then stops the threads
+        void spawn(Instance * instance);
+        void wait(); // until everything spawned so far has finished
+    private:
+        struct State;
+        State * state;
+        Scheduler(const Scheduler &);
+        Scheduler & operator=(const Scheduler &);
+};
+
+/**
+ * What brainfuck.exe --publish-stats keeps up to date about itself, in a POSIX shared memory segment named
+ * /brainfuck.<pid> (bfstat.cpp reads it). There's one writer, which never waits for readers: it makes sequence odd,
+ * changes the rest, then makes it even again. A reader copies the whole thing out, and tries again
+ * if sequence was odd or changed while it was copying.
+ */
+struct Stats {
+    enum { MAGIC = 0x62667374 }; // "bfst"
+    typedef enum { STARTING, PARSING, LOWERING, RUNNING, DONE } Phase;
+    unsigned int magic;
+    volatile unsigned int phase;
+    volatile unsigned long long sequence;
+    volatile unsigned long long files;      // finished
+    volatile unsigned long long iterations; // loop back-edges taken
+    volatile unsigned long long input;      // bytes read
+    volatile unsigned long long output;     // bytes written
+    volatile unsigned long long compiled;   // instructions in the bytecode that's running
+};
+
+}
+
+#endif
@@ -0,0 +1,197 @@
+/*
+= Compile-time Brainfuck
+
+For Brainfuck programs embedded in C++ as string literals. The compiler does the parsing (and the [-] folding),
+so there's no parse() at startup and no visitors to walk.
+
+----
+#include "constexpr-brainfuck.h"
+
+constexpr auto hello = bf::parse("++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++..+++.>>.<-.<.+++.------.--------.>>+.>++.");
+
+// Takes no input? Then it runs in the compiler too, and all that's left at runtime is the text.
+constexpr auto greeting = bf::evaluate<64>(hello);
+static_assert(greeting.size == 13, "Hello World!\n");
+
+// Takes input? Then it becomes a function specialized for that program: each command is inlined C++.
+constexpr auto echo = bf::parse("+[>,.<]");
+bf::run<echo>([] { return getchar(); }, [](char c) { putchar(c); });
+----
+
+Needs C++17. Programs that run long at compile time may need -fconstexpr-loop-limit / -fconstexpr-ops-limit raised,
+and deeply nested ones -ftemplate-depth. Unbalanced brackets, or evaluate() on a program that reads input,
+are compile errors.
+*/
+
+#ifndef CONSTEXPR_BRAINFUCK_H
+#define CONSTEXPR_BRAINFUCK_H
+
+#include <cstddef>
+#include <utility>
+
+namespace bf {
+
+const std::size_t TAPE = 30000;
+const std::size_t NONE = std::size_t(-1);
+
+/**
+ * Same idea as the Command enum in brainfuck.cpp, but runs of +/- and </> are already folded into one signed count,
+ * and the brackets know where their partner is.
+ */
+enum Op { ADD, MOVE, ZERO, INPUT, OUTPUT, OPEN, CLOSE };
+
+struct Instruction {
+    Op op;
+    int arg; // ADD/MOVE: signed count. INPUT/OUTPUT: count. OPEN/CLOSE: index of the partner bracket.
+};
+
+/**
+ * A parsed program. N is the length of the literal, which is as many instructions as it could ever need.
+ * parent[i] is the OPEN of the innermost loop around instruction i, or NONE at the top level.
+ */
+template <std::size_t N>
+struct Program {
+    Instruction code[N];
+    std::size_t parent[N];
+    std::size_t size;
+    bool input;
+};
+
+template <std::size_t N>
+struct Output {
+    char text[N];
+    std::size_t size;
+};
+
+template <std::size_t N>
+constexpr Program<N> parse(const char (&source)[N]) {
+    Program<N> p = {};
+    std::size_t stack[N] = {};
+    std::size_t depth = 0;
+    for (std::size_t i = 0; i + 1 < N; i++) {
+        char c = source[i];
+        std::size_t parent = depth ? stack[depth - 1] : NONE;
+        if (c == '[') {
+            p.parent[p.size] = parent;
+            p.code[p.size] = Instruction{OPEN, 0};
+            stack[depth++] = p.size++;
+        } else if (c == ']') {
+            if (!depth) throw "unbalanced ]";
+            std::size_t open = stack[--depth];
+            if (p.size == open + 2 && p.code[open + 1].op == ADD && p.code[open + 1].arg % 2) {
+                // [-] and [+] (any odd count, really) just zero the cell.
+                p.size = open;
+                p.code[p.size++] = Instruction{ZERO, 0};
+            } else {
+                p.parent[p.size] = open;
+                p.code[p.size] = Instruction{CLOSE, int(open)};
+                p.code[open].arg = int(p.size++);
+            }
+        } else if (c == '+' || c == '-' || c == '>' || c == '<' || c == ',' || c == '.') {
+            Op op = c == '+' || c == '-' ? ADD : c == '>' || c == '<' ? MOVE : c == ',' ? INPUT : OUTPUT;
+            int delta = c == '-' || c == '<' ? -1 : 1;
+            p.input = p.input || op == INPUT;
+            if (p.size && p.code[p.size - 1].op == op && (op == ADD || op == MOVE || source[i - 1] == c)) {
+                p.code[p.size - 1].arg += delta;
+            } else {
+                p.parent[p.size] = parent;
+                p.code[p.size++] = Instruction{op, delta};
+            }
+        }
+        // Anything else is a comment.
+    }
+    if (depth) throw "unbalanced [";
+    return p;
+}
+
+/**
+ * Runs an input-free program at compile time. M bounds the output; going past it is a compile error.
+ */
+template <std::size_t M, std::size_t N>
+constexpr Output<M> evaluate(const Program<N> & p) {
+    if (p.input) throw "evaluate() needs a program that reads no input; use run<>() instead";
+    Output<M> out = {};
+    unsigned char tape[TAPE] = {};
+    std::size_t pointer = 0;
+    for (std::size_t pc = 0; pc < p.size; pc++) {
+        const Instruction & i = p.code[pc];
+        switch (i.op) {
+            case ADD:    tape[pointer] = (unsigned char)(tape[pointer] + i.arg); break;
+            case MOVE:   pointer += i.arg; break;
+            case ZERO:   tape[pointer] = 0; break;
+            case INPUT:  break;
+            case OUTPUT:
+                for (int n = 0; n < i.arg; n++) {
+                    if (out.size == M) throw "evaluate<M>(): output is longer than M";
+                    out.text[out.size++] = char(tape[pointer]);
+                }
+                break;
+            case OPEN:   if (!tape[pointer]) pc = i.arg; break;
+            case CLOSE:  if (tape[pointer]) pc = i.arg; break;
+        }
+    }
+    return out;
+}
+
+template <class In, class Out>
+struct Machine {
+    unsigned char tape[TAPE];
+    std::size_t pointer;
+    In & in;
+    Out & out;
+};
+
+template <const auto & P, std::size_t Begin, std::size_t End, class M>
+inline void block(M & m);
+
+/**
+ * One instruction of P, if it belongs directly to the block whose OPEN is Parent; loop bodies are their own blocks.
+ */
+template <const auto & P, std::size_t I, std::size_t Parent, class M>
+inline void step(M & m) {
+    constexpr Instruction i = P.code[I];
+    if constexpr (P.parent[I] != Parent) {
+        return;
+    } else if constexpr (i.op == ADD) {
+        m.tape[m.pointer] += (unsigned char)i.arg;
+    } else if constexpr (i.op == MOVE) {
+        m.pointer += i.arg;
+    } else if constexpr (i.op == ZERO) {
+        m.tape[m.pointer] = 0;
+    } else if constexpr (i.op == INPUT) {
+        for (int n = 0; n < i.arg; n++) {
+            int c = m.in();
+            if (c >= 0) m.tape[m.pointer] = (unsigned char)c; // at EOF, leave the cell alone like brainfuck.exe does
+        }
+    } else if constexpr (i.op == OUTPUT) {
+        for (int n = 0; n < i.arg; n++) m.out(char(m.tape[m.pointer]));
+    } else if constexpr (i.op == OPEN) {
+        while (m.tape[m.pointer]) {
+            block<P, I + 1, std::size_t(i.arg), M>(m);
+        }
+    }
+}
+
+template <const auto & P, std::size_t Begin, class M, std::size_t... Is>
+inline void sequence(M & m, std::index_sequence<Is...>) {
+    (step<P, Begin + Is, (Begin ? Begin - 1 : NONE), M>(m), ...);
+}
+
+template <const auto & P, std::size_t Begin, std::size_t End, class M>
+inline void block(M & m) {
+    sequence<P, Begin, M>(m, std::make_index_sequence<End - Begin>());
+}
+
+/**
+ * Runs P with in() giving the next input byte (negative at EOF) and out(c) taking each output byte.
+ * P has to be a constexpr Program with static storage, e.g. a namespace scope constexpr variable.
+ */
+template <const auto & P, class In, class Out>
+void run(In && in, Out && out) {
+    Machine<In, Out> m = { {}, 0, in, out };
+    block<P, 0, P.size>(m);
+}
+
+}
+
+#endif
@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# Builds brainfuck.cpp with profile-guided optimization and link-time optimization.
+# An instrumented build runs our programs first, and the real build lays out and inlines by what it saw.
+# Run it from src/: ./pgo.sh [output], which defaults to brainfuck-pgo.exe.
+
+output=${1:-brainfuck-pgo.exe}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+flags="-O2 -pthread -flto=auto"
+
+# Same output name both times: that's what the profile data is filed under.
+g++ $flags -fprofile-generate -fprofile-update=atomic -o "$work/brainfuck" brainfuck.cpp || exit 1
+
+train() {
+    "$work/brainfuck" "$@" > /dev/null 2>&1
+}
+train helloworld.bf
+train 99botles.bf
+train quine.bf
+train heavy.bf
+# echo.bf never stops by itself: at EOF it keeps printing the last byte. The fuel is the dictionary and then some.
+train --fuel 2000000 echo.bf < ../american-english.txt
+train --direct 99botles.bf
+train --tree 99botles.bf
+
+g++ $flags -fprofile-use -fprofile-partial-training -o "$work/brainfuck" brainfuck.cpp || exit 1
+mv "$work/brainfuck" "$output"
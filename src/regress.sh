@@ -0,0 +1,60 @@
+#!/bin/bash
+# Programs that have gone wrong before, and what they should do. Run from src, after building brainfuck.exe:
+#
+#     ./regress.sh [path/to/brainfuck.exe]
+
+bf="${1:-./brainfuck.exe}"
+work="$(mktemp -d)"
+trap 'rm -rf "$work"' EXIT
+failed=0
+
+# check <name> <program> <expected output, as od -An -tu1 prints it> [flags...]
+check() {
+    local name="$1" program="$2" expected="$3"
+    shift 3
+    printf '%s' "$program" > "$work/program.bf"
+    local actual
+    actual="$("$bf" "$@" "$work/program.bf" < /dev/null 2>&1 | od -An -tu1 | tr -s ' \n' ' ' | sed 's/^ //; s/ $//')"
+    if [ "$actual" != "$expected" ]; then
+        echo "FAIL $name: expected '$expected', got '$actual'"
+        failed=1
+    fi
+}
+
+# Nested memo loops each keep their own memo slot.
+check nested-memo '-[>-[>-[>-[>+<-]<-]<-]<-]>>>>.' '1'
+# Parallel tasks count the whole span of their vector ops, so they don't share cells.
+check parallel-lanes '-[>-[>--[>+>+>+>+<<<<--]<-]<-]>>>>>>>>-[>-[>--[>+<--]<-]<-]>>>.<<<<<.>.>.>.' '127 127 0 0 0' --parallel
+# --fuel N allows exactly N taken back-edges.
+check fuel-exact '++++++[>+<--]>.' '3' --fuel 2
+# Dropping dead code doesn't write out a move that cancels around it.
+check minify-dead-move '>>[-]<<[.]' '10' --minify
+check minify-dead-trap '>[]<[-]+.' '43 46 10' --minify
+# --tape-out can write back to the --tape-in file.
+printf 'abc' > "$work/tape"
+check tape-in-place '+>+>+' '' --tape-in "$work/tape" --tape-out "$work/tape"
+check tape-in-place-read '.>.>.' '98 99 100' --tape-in "$work/tape"
+# heavy.bf's four tables are far enough apart to run at once.
+groups="$("$bf" --opcode-stats --parallel heavy.bf | sed -n 's/\tparallel groups$//p')"
+if [ "$groups" != 1 ]; then
+    echo "FAIL heavy-parallel: expected 1 parallel group, got '$groups'"
+    failed=1
+fi
+# Printing from off the end of the tape is an error, not a byte of padding.
+printf '<<<<<.' > "$work/program.bf"
+if "$bf" "$work/program.bf" > "$work/out" 2> /dev/null < /dev/null || [ -s "$work/out" ]; then
+    echo "FAIL tape-offset: ran off the tape without an error"
+    failed=1
+fi
+# A profile claiming more loops than it has is ignored, not allocated.
+echo 'brainfuck-profile 1 999999999999' > "$work/profile"
+printf '+++.' > "$work/program.bf"
+if [ "$("$bf" --profile-in "$work/profile" "$work/program.bf" 2> /dev/null | od -An -tu1 | tr -d ' \n')" != 3 ]; then
+    echo "FAIL profile-count: didn't run with a bad profile"
+    failed=1
+fi
+
+if [ $failed = 0 ]; then
+    echo "All good."
+fi
+exit $failed